@@ -372,13 +372,34 @@ void print_grid(GRID &grid, bool curses, FILE* f) {
     }
 }
 
-int make_grid(const char* &path, GRID &grid) {
+// forget the previous grid file, so that make_grid()
+// can be called more than once (e.g. by a program using libxw)
+//
+void clear_grid_file() {
+    memset(file_chars, 0, sizeof(file_chars));
+    file_nrows = file_ncols = 0;
+    memset(chars, 0, sizeof(chars));
+    memset(bar_right, 0, sizeof(bar_right));
+    memset(bar_left, 0, sizeof(bar_left));
+    memset(bar_above, 0, sizeof(bar_above));
+    memset(bar_below, 0, sizeof(bar_below));
+    memset(across_slots, 0, sizeof(across_slots));
+    memset(down_slots, 0, sizeof(down_slots));
+    across_slots_list.clear();
+    down_slots_list.clear();
+    wrap[0] = wrap[1] = false;
+    twist[0] = twist[1] = false;
+}
+
+void make_grid(const char* &path, GRID &grid) {
     if (!path) path = DEFAULT_GRID_FILE;
     FILE *f = fopen(path, "r");
     if (!f) {
         fprintf(stderr, "can't open %s\n", path);
         exit(1);
     }
+    clear_grid_file();
     read_grid_file(f, grid); 
+    fclose(f);
     find_slots(grid);
 }
@@ -1,5 +1,5 @@
 # Compare the performance of algorithm variants;
-# none, backjump, and prune.
+# none, backjump, prune, and cbj (conflict-directed backjumping).
 #
 # A 'task' is the combination of
 # - a variant
@@ -24,6 +24,12 @@
 # bs_grids.txt: a list of black-square grid filenames
 # bar_grids.txt: a list of bar grid filenames
 # word_lists.txt: a list of word list filenames
+#   (text, or compiled with xwdict, which start up faster)
+# output files:
+# <word list>.<variant>.snap: pattern lists for that word list
+#   and variant (--pattern_snapshot).
+#   Each variant has its own, and each task does an untimed run first,
+#   so the timed runs of all variants start with a warm snapshot.
 
 MAX_TIME_PER_CELL = 1.
 NSEEDS = 10
@@ -31,20 +37,22 @@ NSEEDS = 10
 variant_names = [
     'default',
     'prune',
-    'backjump'
+    'backjump',
+    'cbj'
 ]
 variant_args = [
     '',
     '--prune',
-    '--backjump'
+    '--backjump',
+    '--cbj'
 ]
-nvariants = 3
+nvariants = 4
 
 bs_grids = []
 bar_grids = []
 word_lists = []
 
-import subprocess, json, statistics
+import subprocess, json, statistics, os
 
 class TASK_RESULT:
     def __init__(self, var, gtype, gfile, wfile):
@@ -73,11 +81,17 @@ def do_task(var: int, gtype: str, gfile: str, wfile: str) -> TASK_RESULT:
         '--word_list', wfile,
         '--max_time', '180',
         '--perf',
-        '--shuffle'
+        '--shuffle',
+        '--pattern_snapshot', '%s.%s.snap'%(
+            os.path.basename(wfile), variant_names[var]
+        )
+            # pattern lists, kept across runs with this word list
     ]
     if variant_args[var] != '':
         cmd.append(variant_args[var])
     print('cmd: ', cmd)
+    # warm up the snapshot; this run isn't counted
+    subprocess.check_output(cmd)
     nsteps = []
     cpu_time = []
     nsuccess = 0
@@ -127,7 +141,7 @@ def do_variant(var: int) -> list[TASK_RESULT]:
     return results
 
 # show a comparison of the variants
-# 'var_results' is a list of the list of TASK_RESULTS for the 3 variants
+# 'var_results' is a list of the list of TASK_RESULTS for the variants
 # These lists are in the same order.
 # For each task, compute
 # - the 'success rank' of each variant
@@ -375,6 +375,20 @@ void print_grid(GRID &grid, bool curses, FILE *f) {
     }
 }
 
+// forget the previous grid file, so that make_grid()
+// can be called more than once (e.g. by a program using libxw)
+//
+void clear_grid_file() {
+    mirror = false;
+    wrap[0] = wrap[1] = false;
+    twist[0] = twist[1] = false;
+    memset(chars, 0, sizeof(chars));
+    memset(across_slots, 0, sizeof(across_slots));
+    memset(down_slots, 0, sizeof(down_slots));
+    across_slots_list.clear();
+    down_slots_list.clear();
+}
+
 void make_grid(const char* &path, GRID &grid) {
     if (!path) path = DEFAULT_GRID_FILE;
     FILE *f = fopen(path, "r");
@@ -382,6 +396,8 @@ void make_grid(const char* &path, GRID &grid) {
         printf("no grid file %s\n", path);
         exit(1);
     }
+    clear_grid_file();
     read_grid_file(f);
+    fclose(f);
     find_slots(grid);
 }
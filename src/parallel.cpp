@@ -0,0 +1,452 @@
+// parallel searches for the first solution of a grid.
+//
+// Each worker thread has its own copy of the grid (slots and filled stack),
+// with its own pattern cache, word order, and algorithm variant;
+// the word lists and letter index are shared and read-only.
+// The first solution found stops all the workers.
+//
+// There are two ways to use the workers:
+//
+// --threads: we fill the first few slots in all usable ways;
+// each of the resulting partial fills is a 'task':
+// the subtree of the search below that prefix.
+// Worker threads take tasks from a work-stealing pool.
+//
+// --portfolio: each worker does the whole search,
+// with a different variant (prune, backjump) and word order.
+
+#include <cstdio>
+#include <ctime>
+#include <unistd.h>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <deque>
+
+#include "xw.h"
+
+#define TASKS_PER_THREAD    8
+    // expand the prefix until there are this many tasks per thread
+#define MAX_TASK_DEPTH      6
+
+// a partial fill: words for the first few filled slots
+//
+struct TASK {
+    vector<int> slots;
+        // indices in GRID::slots
+    vector<int> words;
+        // the word for each slot (index in words.words[len])
+};
+
+// each worker has a queue of tasks.
+// It takes tasks from the front of its own queue,
+// and when that's empty, steals from the back of other queues.
+//
+struct TASK_QUEUE {
+    mutex lock;
+    deque<TASK> tasks;
+};
+
+struct WORKER {
+    int id;
+    GRID *grid;
+    thread thr;
+
+    // search configuration; the rest is in the grid
+    bool prune;
+    bool backjump;
+    bool propagate;
+    bool cbj;
+    unsigned int seed;
+        // if nonzero, the grid's word order is shuffled with this seed
+
+    // results
+    int ntasks;
+    int nsteps;
+    double cpu_time;
+
+    // copy the configuration of the given grid
+    void init(int _id, GRID &g, int nworkers) {
+        id = _id;
+        grid = g.clone();
+        grid->cache.budget.max_bytes /= nworkers;
+        prune = g.do_prune;
+        backjump = g.do_backjump;
+        propagate = g.do_propagate;
+        cbj = g.do_cbj;
+        seed = 0;
+        ntasks = 0;
+        nsteps = 0;
+        cpu_time = 0;
+    }
+};
+
+static vector<TASK_QUEUE> queues;
+static atomic<bool> stop;
+static mutex solution_lock;
+static int winner;
+static double start_wall_time;
+static double solution_wall_time;
+
+static double get_wall_time() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+static bool get_task(int id, TASK &task) {
+    int n = queues.size();
+    for (int i=0; i<n; i++) {
+        TASK_QUEUE &q = queues[(id+i)%n];
+        lock_guard<mutex> guard(q.lock);
+        if (q.tasks.empty()) continue;
+        if (i == 0) {
+            task = q.tasks.front();
+            q.tasks.pop_front();
+        } else {
+            task = q.tasks.back();
+            q.tasks.pop_back();
+        }
+        return true;
+    }
+    return false;
+}
+
+// Fill the next 'depth' slots (chosen as in push_next_slot())
+// in all usable ways, and add each result to 'tasks'.
+// Leaves the grid as it was.
+//
+static void make_tasks(
+    GRID &grid, int depth, TASK &prefix, vector<TASK> &tasks
+) {
+    if (depth == 0
+        || grid.filled_slots.size() + grid.npreset_slots == grid.slots.size()
+    ) {
+        tasks.push_back(prefix);
+        return;
+    }
+    SLOT *slot = grid.select_slot();
+    int slot_index = 0;
+    while (grid.slots[slot_index] != slot) slot_index++;
+    size_t level = grid.filled_slots.size();
+    slot->next_word_index = 0;
+    while (slot->find_next_usable_word()) {
+        int next = slot->next_word_index;
+        prefix.slots.push_back(slot_index);
+        prefix.words.push_back(slot->word_index);
+        if (grid.push_slot(slot)) {
+            make_tasks(grid, depth-1, prefix, tasks);
+        }
+        while (grid.filled_slots.size() > level) {
+            grid.pop_slot();
+        }
+        slot->next_word_index = next;
+        prefix.slots.pop_back();
+        prefix.words.pop_back();
+    }
+}
+
+// set up the worker's grid: algorithm variant and word order.
+// Then prepare it
+//
+static void init_worker_thread(WORKER *w) {
+    GRID *g = w->grid;
+    g->do_prune = w->prune;
+    g->do_backjump = w->backjump;
+    g->do_propagate = w->propagate;
+    g->do_cbj = w->cbj;
+    if (w->prune || w->backjump || w->propagate) {
+        g->do_nogoods = false;
+    }
+    if (w->prune) {
+        g->do_lcv = false;
+        g->use_mwords = false;
+    }
+    if (w->seed) {
+        g->cache.order.shuffle(w->seed);
+    }
+    g->prepare_grid();
+}
+
+// search from the grid's current state until we find a solution,
+// backtrack to the floor, run out of time, or are told to stop.
+// Return true if found a solution
+//
+static bool search(GRID &grid) {
+    while (!stop.load(memory_order_relaxed)) {
+        if (grid.filled_slots.size() + grid.npreset_slots == grid.slots.size()) {
+            if (grid.expand_mwords()) {
+                return true;
+            }
+            if (grid.do_cbj && !grid.filled_slots.empty()) {
+                SLOT *top = grid.filled_slots.back();
+                top->conflicts.add_below(top->stack_level);
+            }
+            if (!grid.backtrack()) {
+                return false;
+            }
+            continue;
+        }
+        if (!grid.push_next_slot()) {
+            if (!grid.backtrack()) {
+                return false;
+            }
+        }
+        if (max_time && !(grid.nsteps % step_period)) {
+            if (get_thread_cpu_time() > max_time) {
+                return false;
+            }
+        }
+    }
+    return false;
+}
+
+static void found_solution(WORKER *w) {
+    lock_guard<mutex> guard(solution_lock);
+    if (!stop.exchange(true)) {
+        winner = w->id;
+        solution_wall_time = get_wall_time() - start_wall_time;
+    }
+}
+
+// install the task's prefix in a worker's grid,
+// and search the subtree below it.
+// Return true if found a solution
+//
+static bool do_task(WORKER &w, TASK &task) {
+    GRID &grid = *w.grid;
+    bool found = false;
+    for (unsigned int i=0; i<task.slots.size(); i++) {
+        SLOT *slot = grid.slots[task.slots[i]];
+        strcpy(slot->current_word, words.words[slot->len][task.words[i]]);
+        slot->word_index = words.canon[slot->len][task.words[i]];
+        slot->next_word_index = slot->compatible_words->size();
+        if (!grid.push_slot(slot)) {
+            // the worker's variant (e.g. propagation) rejects the prefix;
+            // there's nothing below it
+            goto done;
+        }
+    }
+    grid.floor_level = grid.filled_slots.size();
+
+    found = search(grid);
+
+    // go back to the initial state for the next task
+    //
+done:
+    grid.floor_level = 0;
+    if (!found) {
+        while (!grid.filled_slots.empty()) {
+            grid.pop_slot();
+        }
+    }
+    return found;
+}
+
+static void worker_main(WORKER *w) {
+    init_worker_thread(w);
+    TASK task;
+    while (!stop.load(memory_order_relaxed) && get_task(w->id, task)) {
+        w->ntasks++;
+        if (do_task(*w, task)) {
+            found_solution(w);
+            break;
+        }
+        if (max_time && get_thread_cpu_time() > max_time) {
+            break;
+        }
+    }
+    w->nsteps = w->grid->nsteps;
+    w->cpu_time = get_thread_cpu_time();
+}
+
+static void portfolio_worker_main(WORKER *w) {
+    init_worker_thread(w);
+    w->ntasks = 1;
+    if (search(*w->grid)) {
+        found_solution(w);
+    }
+    w->nsteps = w->grid->nsteps;
+    w->cpu_time = get_thread_cpu_time();
+}
+
+// copy the winning worker's solution to the original grid, for printing
+//
+static void copy_solution(GRID &grid, GRID &g) {
+    for (unsigned int i=0; i<grid.slots.size(); i++) {
+        SLOT *s = grid.slots[i];
+        SLOT *s2 = g.slots[i];
+        s->filled = s2->filled;
+        strcpy(s->current_word, s2->current_word);
+        strcpy(s->filled_pattern, s2->filled_pattern);
+    }
+}
+
+static void run_workers(vector<WORKER> &workers, void (*f)(WORKER*)) {
+    stop = false;
+    winner = -1;
+    for (WORKER &w: workers) {
+        w.thr = thread(f, &w);
+    }
+    for (WORKER &w: workers) {
+        w.thr.join();
+    }
+}
+
+// Find a solution using nthreads worker threads.
+// If found, copy it to 'grid' and return true.
+//
+bool find_first_solution_parallel(GRID &grid, int nthreads) {
+    start_wall_time = get_wall_time();
+
+    // make the tasks, using the main thread's grid
+    //
+    vector<TASK> tasks;
+    TASK prefix;
+    for (int depth=1; depth<=MAX_TASK_DEPTH; depth++) {
+        size_t n = tasks.size();
+        tasks.clear();
+        make_tasks(grid, depth, prefix, tasks);
+        if (tasks.size() >= (size_t)(TASKS_PER_THREAD*nthreads)) break;
+        if (tasks.size() == n) break;
+    }
+    if (verbose) {
+        printf("%d tasks\n", (int)tasks.size());
+    }
+
+    // deal tasks to the workers, in order,
+    // so that each starts on one of the first tasks
+    //
+    queues = vector<TASK_QUEUE>(nthreads);
+    for (unsigned int i=0; i<tasks.size(); i++) {
+        queues[i%nthreads].tasks.push_back(tasks[i]);
+    }
+
+    vector<WORKER> workers(nthreads);
+    for (int i=0; i<nthreads; i++) {
+        workers[i].init(i, grid, nthreads);
+    }
+    run_workers(workers, worker_main);
+    double wall_time = get_wall_time() - start_wall_time;
+
+    int nsteps = 0;
+    for (WORKER &w: workers) {
+        nsteps += w.nsteps;
+    }
+    if (winner >= 0) {
+        copy_solution(grid, *workers[winner].grid);
+    }
+
+    if (perf) {
+        if (winner < 0) {
+            printf("{\n\
+        \"success\": 0,\n\
+        \"nthreads\": %d\n\
+}\n",
+                nthreads
+            );
+        } else {
+            printf("{\n\
+        \"success\": 1,\n\
+        \"nsteps\": %d,\n\
+        \"cpu_time\": %f,\n\
+        \"wall_time\": %f,\n\
+        \"nthreads\": %d,\n\
+        \"ntasks\": %d\n\
+}\n",
+                nsteps, get_cpu_time(), solution_wall_time, nthreads,
+                (int)tasks.size()
+            );
+        }
+        return winner >= 0;
+    }
+
+    if (winner >= 0) {
+        printf("\nSolution found by thread %d:\n", winner);
+        print_grid(grid, false, stdout);
+        printf("Time to first solution: %f sec\n", solution_wall_time);
+    } else {
+        printf("no solution found\n");
+    }
+    printf("Tasks: %d\n", (int)tasks.size());
+    printf("Wall time: %f sec\n", wall_time);
+    for (WORKER &w: workers) {
+        printf("thread %d: %d tasks, %d steps, CPU time %f, %.0f steps/sec\n",
+            w.id, w.ntasks, w.nsteps, w.cpu_time,
+            w.cpu_time>0?w.nsteps/w.cpu_time:0.
+        );
+    }
+    printf("Steps: %d\n", nsteps);
+    return winner >= 0;
+}
+
+// Run n complete searches concurrently, cycling through the variants
+// (default, prune, backjump, propagate, cbj).
+// The first five use the current word order; the rest use shuffled orders.
+// If one finds a solution, copy it to 'grid' and return true.
+//
+bool find_first_solution_portfolio(GRID &grid, int n) {
+    start_wall_time = get_wall_time();
+    unsigned int base_seed = time(0) + getpid();
+    vector<WORKER> workers(n);
+    for (int i=0; i<n; i++) {
+        WORKER &w = workers[i];
+        w.init(i, grid, n);
+        w.prune = (i%5 == 1);
+        w.backjump = (i%5 == 2);
+        w.propagate = (i%5 == 3);
+        w.cbj = (i%5 == 4);
+        if (i >= 5) {
+            w.seed = base_seed + i;
+        }
+    }
+    run_workers(workers, portfolio_worker_main);
+    double wall_time = get_wall_time() - start_wall_time;
+
+    if (winner >= 0) {
+        copy_solution(grid, *workers[winner].grid);
+    }
+    if (perf) {
+        if (winner < 0) {
+            printf("{\n\
+        \"success\": 0,\n\
+        \"nportfolio\": %d\n\
+}\n",
+                n
+            );
+        } else {
+            WORKER &w = workers[winner];
+            printf("{\n\
+        \"success\": 1,\n\
+        \"nsteps\": %d,\n\
+        \"cpu_time\": %f,\n\
+        \"wall_time\": %f,\n\
+        \"nportfolio\": %d,\n\
+        \"variant\": \"%s\",\n\
+        \"seed\": %u\n\
+}\n",
+                w.nsteps, get_cpu_time(), solution_wall_time, n,
+                w.grid->variant_name(), w.seed
+            );
+        }
+        return winner >= 0;
+    }
+
+    if (winner >= 0) {
+        WORKER &w = workers[winner];
+        printf("\nSolution found by search %d (variant %s, seed %u):\n",
+            winner, w.grid->variant_name(), w.seed
+        );
+        print_grid(grid, false, stdout);
+        printf("Time to first solution: %f sec\n", solution_wall_time);
+    } else {
+        printf("no solution found\n");
+    }
+    printf("Wall time: %f sec\n", wall_time);
+    for (WORKER &w: workers) {
+        printf("search %d: variant %s, seed %u, %d steps, CPU time %f\n",
+            w.id, w.grid->variant_name(), w.seed, w.nsteps, w.cpu_time
+        );
+    }
+    return winner >= 0;
+}
@@ -0,0 +1,205 @@
+// SOLVER: fill grids from a program (see solver.h).
+// The command-line program (xw_main.cpp) uses it too,
+// with callbacks for its output and interaction.
+// copyright (C) 2025 David P. Anderson
+
+#include <cstdio>
+#include <random>
+
+#include "solver.h"
+
+// the options that can't be used together.
+// The command-line program has more (--threads etc.)
+//
+const char* SOLVER_CONFIG::check() {
+    if (propagate && (prune || backjump)) {
+        // their bookkeeping assumes a slot's words are rejected
+        // only because of its crossings
+        return "propagate can't be used with prune or backjump";
+    }
+    if (cbj && (prune || backjump)) {
+        return "cbj can't be used with prune or backjump";
+    }
+    if (nogoods && (prune || backjump || propagate)) {
+        // with these, a slot's failure depends on more than its state
+        return "nogoods can't be used with prune, backjump, or propagate";
+    }
+    if (maximize_score && (prune || backjump)) {
+        // they assume a word fails only because of its crossings
+        return "maximize_score can't be used with prune or backjump";
+    }
+    if (mwords && (prune || maximize_score || count)) {
+        // an mword stands for words with different scores,
+        // and for a number of fills that isn't just the product
+        return "mwords can't be used with prune, maximize_score, or count";
+    }
+    if (components && (prune || backjump || maximize_score || mwords)) {
+        // pruning and backjumping assume chronological backtracking;
+        // the others need all the fills of each component together
+        return "components can't be used with prune, backjump, maximize_score, or mwords";
+    }
+    if (lcv && prune) {
+        // pruning replaces the list we're scanning
+        return "lcv can't be used with prune";
+    }
+    if (count && (maximize_score || prune || backjump || restart_base)) {
+        // pruning and legacy backjumping can skip solutions;
+        // the others are about finding (some) solutions
+        return "count can't be used with maximize_score, prune, backjump, or restarts";
+    }
+    if (step_period <= 0) {
+        return "step_period must be positive";
+    }
+    return NULL;
+}
+
+// copy the options to the grid, set up its word order and cache,
+// and prepare it
+//
+void SOLVER::configure(GRID &grid) {
+    grid.allow_dups = config.allow_dups;
+    grid.do_prune = config.prune;
+    grid.do_backjump = config.backjump;
+    grid.do_cbj = config.cbj;
+    grid.do_propagate = config.propagate;
+    grid.do_nogoods = config.nogoods;
+    grid.do_lcv = config.lcv;
+    grid.maximize_score = config.maximize_score;
+    grid.use_mwords = config.mwords;
+    grid.do_matching = config.matching;
+    grid.do_components = config.components;
+    grid.count_solutions = config.count;
+    grid.slot_heap.defer_complete = config.count;
+    grid.cache.budget.max_bytes = config.cache_bytes;
+    grid.nogoods.set_max_bytes(config.nogood_bytes);
+    if (config.seed) {
+        grid.cache.order.shuffle(config.seed);
+    }
+    if (config.maximize_score) {
+        grid.cache.order.sort_by_score();
+    }
+    grid.cache.init();
+    grid.prepare_grid();
+}
+
+// the current fill is done with (a solution, or counted);
+// backtrack to look for others
+//
+static bool reject_fill(GRID &grid) {
+    if (grid.do_cbj && !grid.filled_slots.empty()) {
+        // any level could lead to another solution
+        SLOT *top = grid.filled_slots.back();
+        top->conflicts.add_below(top->stack_level);
+    }
+    return grid.backtrack();
+}
+
+int SOLVER::solve(GRID &grid) {
+    if (config.check()) {
+        return SOLVE_BAD_CONFIG;
+    }
+    configure(grid);
+    return search(grid);
+}
+
+int SOLVER::search(GRID &grid) {
+    double start_cpu_time = get_thread_cpu_time();
+    mt19937 rng(config.seed);
+        // word orders for restarts
+    int retval = SOLVE_DONE;
+    bool found = false;
+    int restart_steps = 0;
+        // nsteps at the last automatic restart
+    int restart_limit = config.restart_base*luby(1);
+    int next_check = config.step_period;
+    restart_requested = false;
+    while (1) {
+        if (grid.filled_slots.size() + grid.npreset_slots == grid.slots.size()) {
+            if (!grid.expand_mwords()) {
+                // the mword slots need duplicate words
+                if (!reject_fill(grid)) break;
+                continue;
+            }
+            grid.nsolutions++;
+            if (config.count) {
+                grid.add_count(1);
+            } else {
+                found = true;
+                if (config.maximize_score) {
+                    // install_word() only allows better solutions
+                    grid.best_score = grid.score;
+                    grid.have_best = true;
+                }
+                if (on_solution && !on_solution(grid)) {
+                    retval = SOLVE_STOPPED;
+                    break;
+                }
+                if (config.max_solutions
+                    && grid.nsolutions >= config.max_solutions
+                ) {
+                    retval = SOLVE_STOPPED;
+                    break;
+                }
+                if (restart_requested) {
+                    // as if the search were just starting
+                    restart_requested = false;
+                    grid.restart(rng());
+                    grid.nsteps = 0;
+                    restart_steps = 0;
+                    next_check = config.step_period;
+                    start_cpu_time = get_thread_cpu_time();
+                    continue;
+                }
+                // the splits' components may have more fills
+                grid.clear_components();
+            }
+            if (!reject_fill(grid)) break;
+            continue;
+        }
+        SLOT *top = grid.scope_top();
+        if (config.count && top && top->nopen == 0) {
+            // all unfilled slots are complete
+            COUNT n;
+            if (grid.count_completions(n)) {
+                grid.add_count(n);
+                if (!reject_fill(grid)) break;
+                continue;
+            }
+        }
+        if (!grid.push_next_slot()) {
+            if (!grid.backtrack()) break;
+        }
+        if (config.restart_base && !found
+            && grid.nsteps - restart_steps >= restart_limit
+        ) {
+            // the search is taking long; start over with a new word order.
+            // Nogoods are kept
+            //
+            grid.nrestarts++;
+            restart_steps = grid.nsteps;
+            restart_limit = config.restart_base*luby(grid.nrestarts+1);
+            if (verbose) {
+                printf("restart %d: next limit %d steps\n",
+                    grid.nrestarts, restart_limit
+                );
+            }
+            grid.restart(rng());
+            continue;
+        }
+        if (grid.nsteps >= next_check) {
+            next_check = grid.nsteps + config.step_period;
+            if (config.max_time
+                && get_thread_cpu_time() - start_cpu_time > config.max_time
+            ) {
+                retval = SOLVE_TIMEOUT;
+                break;
+            }
+            if (on_progress && !on_progress(grid)) {
+                retval = SOLVE_STOPPED;
+                break;
+            }
+        }
+    }
+    cpu_time = get_thread_cpu_time() - start_cpu_time;
+    return retval;
+}
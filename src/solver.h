@@ -0,0 +1,135 @@
+#ifndef SOLVER_H
+#define SOLVER_H
+
+#include <functional>
+
+#include "xw.h"
+
+// The solver as a library (libxw.a), for programs that fill many grids
+// and don't want to start a process, and read the word list, for each.
+// Load the words once:
+//
+//  words.read_veto_file(veto_fname);
+//  words.read(word_list, reverse_words);
+//  words.need_length(len);     // for each length used, if compiled list
+//  words.build_index();
+//
+// Then for each fill make a GRID (add_slot(), presets, add_link(),
+// or the make_grid() of bar.cpp or black_square.cpp),
+// and pass it to SOLVER::solve().
+// The word lists and index aren't changed by a search,
+// so solvers in different threads can run at once, each with its own GRID.
+// But the make_grid() functions keep the file's state in statics,
+// so call them from one thread at a time.
+// The debugging flags (verbose etc.) are still globals.
+
+// algorithm options; see the command-line options of the same names
+//
+struct SOLVER_CONFIG {
+    bool allow_dups;
+    bool prune;
+    bool backjump;
+    bool cbj;
+    bool propagate;
+    bool nogoods;
+    bool lcv;
+    bool maximize_score;
+    bool mwords;
+    bool matching;
+    bool components;
+    bool count;
+        // count the solutions (GRID::solution_count) rather than
+        // reporting them; the fills of slots whose crossings are
+        // all filled aren't enumerated
+    size_t cache_bytes;
+        // pattern cache limit; zero means no limit
+    size_t nogood_bytes;
+    unsigned int seed;
+        // if nonzero, shuffle the word order with this seed.
+        // Also seeds the word orders of restarts
+    int restart_base;
+        // if nonzero, restart after restart_base*luby(i) steps
+        // until a solution is found
+    double max_time;
+        // give up after this many CPU seconds (of the thread
+        // calling solve()); 0 = no limit
+    int step_period;
+        // check the time and call on_progress every this many steps
+    long max_solutions;
+        // stop after this many solutions; 0 = no limit
+
+    SOLVER_CONFIG() {
+        allow_dups = false;
+        prune = false;
+        backjump = false;
+        cbj = false;
+        propagate = false;
+        nogoods = false;
+        lcv = false;
+        maximize_score = false;
+        mwords = false;
+        matching = false;
+        components = false;
+        count = false;
+        cache_bytes = 1000000000;
+        nogood_bytes = 100000000;
+        seed = 0;
+        restart_base = 0;
+        max_time = 0;
+        step_period = 10000;
+        max_solutions = 1;
+    }
+
+    // return NULL if the options can be used together,
+    // else a description of the problem
+    //
+    const char* check();
+};
+
+// returns from SOLVER::solve()
+#define SOLVE_DONE          0
+    // searched everything; no more solutions
+#define SOLVE_STOPPED       1
+    // max_solutions reached, or a callback returned false
+#define SOLVE_TIMEOUT       2
+    // max_time exceeded
+#define SOLVE_BAD_CONFIG    3
+    // config.check() failed
+
+struct SOLVER {
+    SOLVER_CONFIG config;
+    function<bool(GRID&)> on_solution;
+        // called for each solution (with maximize_score: each better one;
+        // with count: not called).
+        // The words are in the slots' current_word.
+        // Return false to stop the search
+    function<bool(GRID&)> on_progress;
+        // called every config.step_period steps with the partial fill.
+        // Return false to stop the search
+    bool restart_requested;
+        // on_solution can set this to start the search over
+        // with a new word order, rather than look for more solutions
+    double cpu_time;
+        // CPU time (of this thread) of the last solve()
+
+    SOLVER() {
+        restart_requested = false;
+        cpu_time = 0;
+    }
+
+    // fill the grid, whose slots, presets and links have been added
+    // (but not prepare_grid()).
+    // A GRID can be solved once; use clone() to solve it again.
+    // Statistics (nsteps, nsolutions, solution_count etc.)
+    // are in the GRID afterwards
+    //
+    int solve(GRID &grid);
+
+    // or do it in two parts, to look at (or clone) the prepared grid
+    // before searching it.  search() doesn't check the config
+    //
+    void configure(GRID &grid);
+    int search(GRID &grid);
+};
+
+#endif
@@ -1,11 +1,17 @@
 #include <cstdio>
 #include <cstring>
 #include <algorithm>
+#include <random>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "xw.h"
 #include "words.h"
 
 WORDS words;
+PATTERN_SNAPSHOT snapshot;
 
 inline void reverse_str(char *s) {
     int length = strlen(s);
@@ -20,29 +26,236 @@ inline void reverse_str(char *s) {
 
 ///////////////// WORDS
 
-// read words from file into per-length vectors
+// read words from file into per-length arenas
+//
+// If it's a compiled list, map it instead.
 //
 void WORDS::read(const char* fname, bool reverse_words) {
+    unmap();
     FILE* f = fopen(fname, "r");
     if (!f) {
         printf("no word list %s\n", fname);
         exit(1);
     }
+    char magic[8];
+    if (fread(magic, 1, 8, f) == 8 && !memcmp(magic, DICT_MAGIC, 8)) {
+        fclose(f);
+        read_dict(fname, reverse_words);
+        return;
+    }
+    rewind(f);
+    for (int i=0; i<=MAX_LEN; i++) {
+        chars[i].clear();
+        score[i].clear();
+        nwords[i] = 0;
+    }
     char buf[256];
     while (fgets(buf, 256, f)) {
-        int len = strlen(buf)-1;
+        // lines are 'word' or 'word;score'
+        int sc = DEFAULT_WORD_SCORE;
+        char *p = strchr(buf, ';');
+        if (p) {
+            sc = atoi(p+1);
+            *p = 0;
+        } else {
+            buf[strlen(buf)-1] = 0;
+        }
+        int len = strlen(buf);
         if (len >= MAX_LEN) continue;
-        buf[len] = 0;
         if (have_vetoed_words[len]) {
             if (vetoed_words[len].find(buf) != vetoed_words[len].end()) {
                 continue;
             }
         }
         nwords[len]++;
-        words[len].push_back(strdup(buf));
+        chars[len].insert(chars[len].end(), buf, buf+len+1);
+        score[len].push_back(sc);
         if (reverse_words) {
             reverse_str(buf);
-            words[len].push_back(strdup(buf));
+            chars[len].insert(chars[len].end(), buf, buf+len+1);
+            score[len].push_back(sc);
+        }
+    }
+    fclose(f);
+    for (int i=0; i<=MAX_LEN; i++) {
+        build_arena(i);
+    }
+}
+
+// given the chars of words of a given length,
+// make the list of pointers, the packed words, and the canonical indices
+//
+void WORDS::build_arena(int len) {
+    int n = chars[len].size()/(len+1);
+    int nlanes = PACKED_LANES(len);
+    words[len].resize(n);
+    packed[len].assign(n*nlanes, 0);
+    arena[len] = chars[len].data();
+    packed_arena[len] = packed[len].data();
+    canon[len].resize(n);
+    unordered_map<string, int> first;
+    vector<int> ncopies(n, 0);
+    max_copies[len] = 1;
+    for (int i=0; i<n; i++) {
+        char *w = &chars[len][i*(len+1)];
+        words[len][i] = w;
+        canon[len][i] = first.emplace(w, i).first->second;
+        max_copies[len] = max(max_copies[len], ++ncopies[canon[len][i]]);
+        uint64_t *p = packed_word(len, i);
+        for (int j=0; j<len; j++) {
+            p[j/12] |= letter_code(w[j]) << ((j%12)*5);
+        }
+    }
+}
+
+///////////////// COMPILED LISTS
+
+// map a compiled list, and load the lengths needed so far
+//
+void WORDS::read_dict(const char* fname, bool reverse_words) {
+    int fd = open(fname, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        printf("can't open %s\n", fname);
+        exit(1);
+    }
+    map_size = st.st_size;
+    void *p = mmap(NULL, map_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED || map_size < sizeof(DICT_HEADER)) {
+        printf("can't map %s\n", fname);
+        exit(1);
+    }
+    map_addr = (char*)p;
+    DICT_HEADER &h = *(DICT_HEADER*)map_addr;
+    if (h.version != DICT_VERSION || h.max_len != MAX_LEN) {
+        printf("%s: wrong version; recompile it with xwdict\n", fname);
+        exit(1);
+    }
+    if ((bool)h.reversed != reverse_words) {
+        printf("%s was compiled %s --reverse\n",
+            fname, h.reversed?"with":"without"
+        );
+        exit(1);
+    }
+    for (int i=0; i<=MAX_LEN; i++) {
+        chars[i].clear();
+        packed[i].clear();
+        words[i].clear();
+        canon[i].clear();
+        score[i].clear();
+        nwords[i] = h.lens[i].nwords;
+        loaded[i] = false;
+        if (needed[i]) load_length(i);
+    }
+}
+
+// the grid has slots of this length; load its words if needed
+//
+void WORDS::need_length(int len) {
+    needed[len] = true;
+    if (map_addr && !loaded[len]) {
+        load_length(len);
+    }
+}
+
+// Point the arenas of the given length into the mapped file.
+// If some of its words are vetoed, copy the others instead
+//
+void WORDS::load_length(int len) {
+    DICT_HEADER &h = *(DICT_HEADER*)map_addr;
+    int n = h.lens[len].nwords;
+    char *base = map_addr + h.lens[len].offset;
+    uint64_t *pk = (uint64_t*)base;
+    int *sc = (int*)(pk + n*PACKED_LANES(len));
+    char *c = (char*)(sc + n);
+    loaded[len] = true;
+    if (have_vetoed_words[len]) {
+        chars[len].clear();
+        score[len].clear();
+        for (int i=0; i<n; i++) {
+            char *w = c + i*(len+1);
+            if (vetoed_words[len].find(w) != vetoed_words[len].end()) {
+                continue;
+            }
+            chars[len].insert(chars[len].end(), w, w+len+1);
+            score[len].push_back(sc[i]);
+        }
+        nwords[len] = score[len].size();
+        build_arena(len);
+        return;
+    }
+    arena[len] = c;
+    packed_arena[len] = pk;
+    words[len].resize(n);
+    canon[len].resize(n);
+    for (int i=0; i<n; i++) {
+        words[len][i] = c + i*(len+1);
+        canon[len][i] = i;
+    }
+    max_copies[len] = 1;
+        // compiled lists have no duplicates
+    score[len].assign(sc, sc+n);
+}
+
+void WORDS::unmap() {
+    if (!map_addr) return;
+    munmap(map_addr, map_size);
+    map_addr = NULL;
+}
+
+// write the words read from a text list as a compiled list,
+// without duplicates (for each word, the highest score)
+//
+void WORDS::write_dict(const char* fname, bool reverse_words) {
+    FILE *f = fopen(fname, "wb");
+    if (!f) {
+        printf("can't create %s\n", fname);
+        exit(1);
+    }
+    DICT_HEADER h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, DICT_MAGIC, 8);
+    h.version = DICT_VERSION;
+    h.max_len = MAX_LEN;
+    h.reversed = reverse_words;
+    uint64_t offset = sizeof(h);
+    vector<int> uniq[MAX_LEN+1];
+    for (int len=0; len<=MAX_LEN; len++) {
+        int n = words[len].size();
+        vector<int> best(score[len]);
+        for (int i=0; i<n; i++) {
+            int j = canon[len][i];
+            if (j == i) {
+                uniq[len].push_back(i);
+            } else {
+                best[j] = max(best[j], score[len][i]);
+            }
+        }
+        for (int &i: uniq[len]) {
+            score[len][i] = best[i];
+        }
+        n = uniq[len].size();
+        h.lens[len].nwords = n;
+        h.lens[len].offset = offset;
+        offset += n*(PACKED_LANES(len)*sizeof(uint64_t) + sizeof(int) + len+1);
+        offset = (offset+7) & ~(uint64_t)7;
+    }
+    fwrite(&h, sizeof(h), 1, f);
+    for (int len=0; len<=MAX_LEN; len++) {
+        for (int i: uniq[len]) {
+            fwrite(packed_word(len, i), sizeof(uint64_t), PACKED_LANES(len), f);
+        }
+        for (int i: uniq[len]) {
+            fwrite(&score[len][i], sizeof(int), 1, f);
+        }
+        for (int i: uniq[len]) {
+            fwrite(words[len][i], 1, len+1, f);
+        }
+        long pos = ftell(f);
+        while (pos & 7) {
+            fputc(0, f);
+            pos++;
         }
     }
     fclose(f);
@@ -73,10 +286,46 @@ void WORDS::print_vetoed_words() {
     printf("vetoed words: %d\n", n);
 }
 
-void WORDS::shuffle() {
+///////////////// WORD_ORDER
+
+// a random order of the words of each length
+//
+void WORD_ORDER::shuffle(unsigned int seed) {
+    mt19937 rng(seed);
     for (int i=1; i<=MAX_LEN; i++) {
-        if (words[i].empty()) continue;
-        random_shuffle(words[i].begin(), words[i].end());
+        int n = words.words[i].size();
+        vector<int> perm(n);
+        for (int j=0; j<n; j++) perm[j] = j;
+        std::shuffle(perm.begin(), perm.end(), rng);
+        rank[i].resize(n);
+        for (int j=0; j<n; j++) {
+            rank[i][perm[j]] = j;
+        }
+    }
+}
+
+// order the words by decreasing score;
+// words with equal scores stay in the current order
+//
+void WORD_ORDER::sort_by_score() {
+    for (int i=1; i<=MAX_LEN; i++) {
+        int n = words.words[i].size();
+        vector<int> perm(n);
+        for (int j=0; j<n; j++) perm[j] = j;
+        vector<int> &r = rank[i];
+        if (!r.empty()) {
+            sort(perm.begin(), perm.end(),
+                [&r](int a, int b) {return r[a] < r[b];}
+            );
+        }
+        vector<int> &sc = words.score[i];
+        stable_sort(perm.begin(), perm.end(),
+            [&sc](int a, int b) {return sc[a] > sc[b];}
+        );
+        r.resize(n);
+        for (int j=0; j<n; j++) {
+            r[perm[j]] = j;
+        }
     }
 }
 
@@ -87,35 +336,378 @@ void WORDS::print_counts() {
     }
 }
 
+///////////////// LETTER_INDEX
+
+void LETTER_INDEX::build(int _len, WLIST &wlist) {
+    len = _len;
+    nwords = wlist.size();
+    nblocks = (nwords+63)/64;
+    bits.assign(len*26*nblocks, 0);
+    for (int i=0; i<nwords; i++) {
+        char *w = wlist[i];
+        uint64_t bit = (uint64_t)1 << (i%64);
+        for (int j=0; j<len; j++) {
+            char c = w[j];
+            if (c<'a' || c>'z') continue;
+            letter_bits(j, c)[i/64] |= bit;
+        }
+    }
+}
+
+// compute the bitset of words matching the pattern
+//
+void LETTER_INDEX::match_bits(char* pattern, BITSET &out) {
+    out.resize(nblocks);
+    bool first = true;
+    for (int j=0; j<len; j++) {
+        char c = pattern[j];
+        if (c == '_') continue;
+        uint64_t *b = letter_bits(j, c);
+        uint64_t *o = out.data();
+        if (first) {
+            for (int k=0; k<nblocks; k++) o[k] = b[k];
+            first = false;
+        } else {
+            for (int k=0; k<nblocks; k++) o[k] &= b[k];
+        }
+    }
+    if (first) {
+        // no letters; all words match
+        for (int k=0; k<nblocks; k++) out[k] = ~(uint64_t)0;
+        if (nwords%64) {
+            out[nblocks-1] = ((uint64_t)1 << (nwords%64)) - 1;
+        }
+    }
+}
+
+// does any word match the pattern?
+// Stops at the first nonzero block, so no result bitset is needed.
+//
+bool LETTER_INDEX::any_match(char* pattern) {
+    uint64_t *b[MAX_LEN];
+    int n = 0;
+    for (int j=0; j<len; j++) {
+        char c = pattern[j];
+        if (c == '_') continue;
+        b[n++] = letter_bits(j, c);
+    }
+    if (n == 0) return nwords > 0;
+    for (int k=0; k<nblocks; k++) {
+        uint64_t x = b[0][k];
+        for (int i=1; x && i<n; i++) {
+            x &= b[i][k];
+        }
+        if (x) return true;
+    }
+    return false;
+}
+
+int LETTER_INDEX::count_matches(char* pattern) {
+    BITSET out;
+    match_bits(pattern, out);
+    int n = 0;
+    for (uint64_t x: out) {
+        n += __builtin_popcountll(x);
+    }
+    return n;
+}
+
+void WORDS::build_index() {
+    for (int i=1; i<=MAX_LEN; i++) {
+        index[i].build(i, words[i]);
+    }
+    snapshot.check();
+}
+
+///////////////// ILIST
+
+void ILIST::compute_letter_masks(int len, WLIST &wlist) {
+    memset(letter_mask, 0, sizeof(letter_mask));
+    for (int i: *this) {
+        char *w = wlist[i];
+        for (int j=0; j<len; j++) {
+            char c = w[j];
+            if (c<'a' || c>'z') continue;
+            letter_mask[j] |= 1 << (c-'a');
+        }
+    }
+}
+
+// count the words with each letter in each position.
+// The counts are charged to the cache budget
+//
+void ILIST::compute_letter_counts() {
+    WLIST &wlist = *cache->wlist;
+    letter_count.assign(len*26, 0);
+    for (int i: *this) {
+        char *w = wlist[i];
+        for (int j=0; j<len; j++) {
+            char c = w[j];
+            if (c<'a' || c>'z') continue;
+            letter_count[j*26 + c-'a']++;
+        }
+    }
+    size_t n = letter_count.size()*sizeof(int);
+    nbytes += n;
+    cache->budget->nbytes += n;
+}
+
 void show_matches(int len, WLIST &wlist, ILIST &ilist) {
     for (int i: ilist) {
         printf("%s\n", wlist[i]);
     }
 }
 
+///////////////// CACHE_BUDGET
+
+// evict unpinned lists, least recently used first,
+// until there's room for n more bytes
+//
+void CACHE_BUDGET::make_room(size_t n) {
+    if (!max_bytes) return;
+    while (nbytes + n > max_bytes && !lru.empty()) {
+        ILIST *ilist = lru.back();
+        lru.pop_back();
+        nbytes -= ilist->nbytes;
+        nevictions++;
+        string key = *ilist->key;
+        ilist->cache->map.erase(key);
+        delete ilist;
+    }
+}
+
+void CACHE_BUDGET::print_stats(FILE *f) {
+    fprintf(f, "pattern cache: %ld hits, %ld misses (%ld from snapshot), %ld evictions, %lu bytes\n",
+        nhits, nmisses, nsnapshot, nevictions, nbytes
+    );
+}
+
+// a slot is using this list; it can't be evicted
+//
+void pin_list(ILIST *ilist) {
+    if (ilist->npins++ == 0) {
+        ilist->cache->budget->lru.erase(ilist->lru_pos);
+    }
+}
+
+void unpin_list(ILIST *ilist) {
+    if (--ilist->npins == 0) {
+        CACHE_BUDGET *budget = ilist->cache->budget;
+        budget->lru.push_front(ilist);
+        ilist->lru_pos = budget->lru.begin();
+    }
+}
+
 // PATTERN_CACHE
-// (not actually a cache since we never flush anything)
 // maps patterns to the list of words matching that pattern.
+// Lists not used by any slot may be evicted (see CACHE_BUDGET).
 
 // 'pattern': a word in which some or all positions are undetermined
 // (represented by _)
 
+// free all lists.  Slots must not be using any of them
+//
+void PATTERN_CACHE::clear() {
+    for (auto &x: map) {
+        ILIST *ilist = x.second;
+        budget->lru.erase(ilist->lru_pos);
+        budget->nbytes -= ilist->nbytes;
+        delete ilist;
+    }
+    map.clear();
+}
+
+// look up a list; if found, make it most recently used.
+// If not, get it from the snapshot if it's there
+//
+ILIST* PATTERN_CACHE::lookup(const string &key) {
+    auto it = map.find(key);
+    if (it == map.end()) {
+        budget->nmisses++;
+        ILIST *ilist = snapshot.get(len, key);
+        if (!ilist) return NULL;
+        budget->nsnapshot++;
+        sort_by_rank(*ilist);
+        insert(key, ilist);
+        return ilist;
+    }
+    budget->nhits++;
+    ILIST *ilist = it->second;
+    if (ilist->npins == 0) {
+        budget->lru.splice(budget->lru.begin(), budget->lru, ilist->lru_pos);
+    }
+    return ilist;
+}
+
+// add a list to the cache, unpinned
+//
+void PATTERN_CACHE::insert(const string &key, ILIST* ilist) {
+    ilist->shrink_to_fit();
+    ilist->compute_letter_masks(len, *wlist);
+    ilist->len = len;
+    ilist->cache = this;
+    ilist->npins = 0;
+    ilist->nbytes = sizeof(ILIST) + ilist->capacity()*sizeof(int)
+        + 2*key.size() + 64;
+    budget->make_room(ilist->nbytes);
+    auto it = map.emplace(key, ilist).first;
+    ilist->key = &it->first;
+    budget->lru.push_front(ilist);
+    ilist->lru_pos = budget->lru.begin();
+    budget->nbytes += ilist->nbytes;
+}
+
 // Get list of words matching pattern.
-// If not in cache, compute and store in cache
+// If not in cache, compute from the letter index and store in cache.
+// The list is in word-list order.
 //
 ILIST* PATTERN_CACHE::get_matches(char* pattern) {
-    auto it = map.find(pattern);
-    if (it != map.end()) {
-        return it->second;
+    ILIST *found = lookup(pattern);
+    if (found) return found;
+    ILIST *ilist = new ILIST;
+    index_matches(pattern, *ilist);
+    insert(pattern, ilist);
+    return ilist;
+}
+
+// compute the list of words matching pattern, using the letter index,
+// in the search's word order
+//
+void PATTERN_CACHE::index_matches(char* pattern, ILIST &ilist) {
+    BITSET bits;
+    words.index[len].match_bits(pattern, bits);
+    for (int k=0; k<(int)bits.size(); k++) {
+        uint64_t x = bits[k];
+        while (x) {
+            ilist.push_back(k*64 + __builtin_ctzll(x));
+            x &= x-1;
+        }
+    }
+    sort_by_rank(ilist);
+}
+
+// put a list in word-list order into the search's word order
+//
+void PATTERN_CACHE::sort_by_rank(ILIST &ilist) {
+    vector<int> &rank = order->rank[len];
+    if (!rank.empty()) {
+        sort(ilist.begin(), ilist.end(),
+            [&rank](int a, int b) {return rank[a] < rank[b];}
+        );
+    }
+}
+
+// Get list of words matching pattern,
+// which is the pattern of the list 'parent' plus a letter at pos.
+// If not in cache, compute it by filtering the parent list by that letter;
+// the cost is proportional to the size of the parent list
+// rather than the number of words of this length.
+// If the parent list is big, the letter index is faster.
+//
+ILIST* PATTERN_CACHE::get_matches_refine(
+    ILIST* parent, char* pattern, int pos
+) {
+    ILIST *found = lookup(pattern);
+    if (found) return found;
+    int nletters = 0;
+    for (int i=0; i<len; i++) {
+        if (pattern[i] != '_') nletters++;
+    }
+    ILIST *ilist = new ILIST;
+    if ((int)parent->size() > nletters*words.index[len].nblocks) {
+        index_matches(pattern, *ilist);
+    } else {
+        char c = pattern[pos];
+        for (int i: *parent) {
+            if (words.word_char(len, i, pos) == c) {
+                ilist->push_back(i);
+            }
+        }
+    }
+    insert(pattern, ilist);
+    return ilist;
+}
+
+// Get the words of the list 'parent' whose letter at pos is in mask
+// (a=bit 0).
+// The key is the parent's key plus the restriction,
+// so it's memoized like any other list
+//
+ILIST* PATTERN_CACHE::get_matches_restrict(
+    ILIST* parent, int pos, unsigned int mask
+) {
+    char buf[32];
+    sprintf(buf, "&%d:%x", pos, mask);
+    string key = *parent->key + buf;
+    ILIST *found = lookup(key);
+    if (found) return found;
+    ILIST *ilist = new ILIST;
+    for (int i: *parent) {
+        char c = words.word_char(len, i, pos);
+        if ((mask >> (c-'a')) & 1) {
+            ilist->push_back(i);
+        }
     }
+    insert(key, ilist);
+    return ilist;
+}
+
+// mwords (--mwords): in a slot with unchecked cells ('free' positions),
+// words that differ only in those positions are interchangeable
+// as far as the crossing slots are concerned.
+// An mword list has, for each distinct projection of the matching words
+// onto the other positions, the first such word in the search's order.
+// The key is the pattern plus the free mask,
+// so it's distinct from the pattern's list of all words
+
+static string mword_key(char* pattern, unsigned int free_mask) {
+    char buf[16];
+    sprintf(buf, "#%x", free_mask);
+    return string(pattern) + buf;
+}
+
+ILIST* PATTERN_CACHE::get_matches_mword(char* pattern, unsigned int free_mask) {
+    string key = mword_key(pattern, free_mask);
+    ILIST *found = lookup(key);
+    if (found) return found;
+    ILIST *all = get_matches(pattern);
     ILIST *ilist = new ILIST;
-    //get_matches(len, pattern, *wlist, *ilist);
-    for (unsigned int i=0; i<wlist->size(); i++) {
-        if (match(len, pattern, (*wlist)[i])) {
+    unordered_set<string> seen;
+    char proj[MAX_LEN];
+    vector<int> &canon = words.canon[len];
+    for (int i: *all) {
+        if (canon[i] != i) continue;
+        char *w = (*wlist)[i];
+        for (int j=0; j<len; j++) {
+            proj[j] = ((free_mask >> j) & 1)?'_':w[j];
+        }
+        if (seen.insert(string(proj, len)).second) {
             ilist->push_back(i);
         }
     }
-    map[pattern] = ilist;
+    insert(key, ilist);
+    return ilist;
+}
+
+// the mword list for pattern, which is the pattern of the mword list
+// 'parent' plus a letter at (non-free) pos.
+// Each mword either matches the letter or doesn't,
+// so filtering the parent gives the same words as collapsing
+//
+ILIST* PATTERN_CACHE::get_matches_mword_refine(
+    ILIST* parent, char* pattern, int pos, unsigned int free_mask
+) {
+    string key = mword_key(pattern, free_mask);
+    ILIST *found = lookup(key);
+    if (found) return found;
+    ILIST *ilist = new ILIST;
+    char c = pattern[pos];
+    for (int i: *parent) {
+        if (words.word_char(len, i, pos) == c) {
+            ilist->push_back(i);
+        }
+    }
+    insert(key, ilist);
     return ilist;
 }
 
@@ -138,12 +730,12 @@ ILIST* PATTERN_CACHE::get_matches_prune(
     }
 
     string sig = prune_signature + prune_pattern;
-    auto it = map.find(sig);
-    if (it != map.end()) {
-        return it->second;
-    }
+    ILIST *cached = lookup(sig);
+    if (cached) return cached;
     ILIST *ilist2 = new ILIST;
     bool found = false;
+    PACKED_PATTERN pp;
+    pp.compile(len, prune_pattern);
 
     // make list of words that don't match the prune pattern.
     // cur_index will always match.
@@ -155,7 +747,7 @@ ILIST* PATTERN_CACHE::get_matches_prune(
             continue;
         }
         int i = (*ilist)[j];
-        if (match(len, prune_pattern, (*wlist)[i])) {
+        if (pp.match(words.packed_word(len, i))) {
             if (verbose_prune) {
                 printf("   pruned %s\n", (*wlist)[i]);
             }
@@ -168,11 +760,12 @@ ILIST* PATTERN_CACHE::get_matches_prune(
         if (verbose_prune) {
             printf("prune: no matching words found\n");
         }
+        next_index = cur_index+1;
         delete ilist2;
         return ilist;
     }
     prune_signature += prune_pattern;
-    map[sig] = ilist2;
+    insert(sig, ilist2);
     if (verbose_prune) {
         printf("   pruned from %d to %d words, index old %d new %d\n",
             (int)ilist->size(), (int)ilist2->size(), cur_index, next_index
@@ -181,10 +774,183 @@ ILIST* PATTERN_CACHE::get_matches_prune(
     return ilist2;
 }
 
-PATTERN_CACHE pattern_cache[MAX_LEN];
+///////////////// SEARCH_CACHE
+
+void SEARCH_CACHE::init() {
+    for (int i=1; i<=MAX_LEN; i++) {
+        pattern_cache[i].init(i, &(words.words[i]), &budget, &order);
+    }
+}
 
-void init_pattern_cache() {
+// slots may still be using lists, so don't bother with the LRU list
+//
+SEARCH_CACHE::~SEARCH_CACHE() {
     for (int i=1; i<=MAX_LEN; i++) {
-        pattern_cache[i].init(i, &(words.words[i]));
+        for (auto &x: pattern_cache[i].map) {
+            delete x.second;
+        }
+    }
+}
+
+///////////////// PATTERN_SNAPSHOT
+
+// FNV-1a, 64 bits, of the words of a length
+//
+static uint64_t words_checksum(int len) {
+    uint64_t h = 14695981039346656037ULL;
+    const uint64_t prime = 1099511628211ULL;
+    int n = words.words[len].size();
+    h = (h ^ (uint64_t)n) * prime;
+    if (!n) return h;
+    const char *p = words.arena[len];
+    for (size_t i=0; i<(size_t)n*(len+1); i++) {
+        h = (h ^ (unsigned char)p[i]) * prime;
+    }
+    return h;
+}
+
+// map a snapshot and index its lists.
+// If there's no such file, we start with an empty one
+//
+void PATTERN_SNAPSHOT::read(const char* fname) {
+    int fd = open(fname, O_RDONLY);
+    if (fd < 0) return;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(SNAPSHOT_HEADER)) {
+        close(fd);
+        return;
+    }
+    map_size = st.st_size;
+    void *p = mmap(NULL, map_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        printf("can't map %s\n", fname);
+        exit(1);
+    }
+    map_addr = (char*)p;
+    SNAPSHOT_HEADER &h = *(SNAPSHOT_HEADER*)map_addr;
+    if (memcmp(h.magic, SNAPSHOT_MAGIC, 8)) {
+        printf("%s is not a pattern snapshot\n", fname);
+        exit(1);
+    }
+    if (h.version != SNAPSHOT_VERSION || h.max_len != MAX_LEN) {
+        // it will be replaced at the end of the run
+        munmap(map_addr, map_size);
+        map_addr = NULL;
+        return;
+    }
+    size_t off = sizeof(SNAPSHOT_HEADER);
+    while (off + sizeof(SNAPSHOT_ENTRY) <= map_size) {
+        SNAPSHOT_ENTRY *e = (SNAPSHOT_ENTRY*)(map_addr + off);
+        if (e->len < 1 || e->len > MAX_LEN || e->keylen < 0 || e->n < 0
+            || off + e->size() > map_size
+        ) {
+            break;      // truncated
+        }
+        index[e->len].emplace(string(e->key(), e->keylen), e);
+        off += e->size();
+    }
+}
+
+// see which lengths' lists are still valid.
+// Call this when the word lists change
+//
+void PATTERN_SNAPSHOT::check() {
+    if (!map_addr) return;
+    SNAPSHOT_HEADER &h = *(SNAPSHOT_HEADER*)map_addr;
+    for (int len=1; len<=MAX_LEN; len++) {
+        valid[len] = !index[len].empty()
+            && h.checksum[len] == words_checksum(len);
+    }
+}
+
+// the list for the given key, in word-list order, or NULL
+//
+ILIST* PATTERN_SNAPSHOT::get(int len, const string &key) {
+    if (!valid[len]) return NULL;
+    auto it = index[len].find(key);
+    if (it == index[len].end()) return NULL;
+    SNAPSHOT_ENTRY *e = it->second;
+    ILIST *ilist = new ILIST;
+    ilist->assign(e->list(), e->list() + e->n);
+    return ilist;
+}
+
+static void write_entry(FILE *f, int len, const string &key, const int *list, int n) {
+    SNAPSHOT_ENTRY e;
+    e.len = len;
+    e.keylen = key.size();
+    e.n = n;
+    fwrite(&e, sizeof(e), 1, f);
+    fwrite(key.data(), 1, e.keylen, f);
+    for (int i=e.keylen; i&3; i++) {
+        fputc(0, f);
+    }
+    fwrite(list, sizeof(int), n, f);
+}
+
+// with a compiled list, only the lengths the grid uses are loaded;
+// the snapshot's lists for other lengths are kept as they are
+//
+static bool length_loaded(int len) {
+    return !words.map_addr || words.loaded[len];
+}
+
+// write the lists in the given cache,
+// and those in the old snapshot that are still valid
+// or are for lengths not loaded in this run.
+// Write a temporary file and rename it,
+// so the old one (which may be mapped) stays intact until then
+//
+void PATTERN_SNAPSHOT::write(const char* fname, SEARCH_CACHE &cache) {
+    string tmp = string(fname) + ".tmp";
+    FILE *f = fopen(tmp.c_str(), "wb");
+    if (!f) {
+        printf("can't create %s\n", tmp.c_str());
+        return;
+    }
+    SNAPSHOT_HEADER h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, SNAPSHOT_MAGIC, 8);
+    h.version = SNAPSHOT_VERSION;
+    h.max_len = MAX_LEN;
+    for (int len=1; len<=MAX_LEN; len++) {
+        if (length_loaded(len)) {
+            h.checksum[len] = words_checksum(len);
+        } else if (map_addr) {
+            h.checksum[len] = ((SNAPSHOT_HEADER*)map_addr)->checksum[len];
+        }
+    }
+    fwrite(&h, sizeof(h), 1, f);
+    for (int len=1; len<=MAX_LEN; len++) {
+        if (!length_loaded(len)) {
+            for (auto &x: index[len]) {
+                SNAPSHOT_ENTRY *e = x.second;
+                write_entry(f, len, x.first, e->list(), e->n);
+            }
+            continue;
+        }
+        PATTERN_CACHE &pc = cache.pattern_cache[len];
+        for (auto &x: pc.map) {
+            const string &key = x.first;
+            if ((int)key.size() != len && key.find('&') == string::npos) {
+                continue;   // prune list
+            }
+            if (key.find('#') != string::npos) {
+                continue;   // mword list
+            }
+            vector<int> list(x.second->begin(), x.second->end());
+            sort(list.begin(), list.end());
+            write_entry(f, len, key, list.data(), list.size());
+        }
+        if (!valid[len]) continue;
+        for (auto &x: index[len]) {
+            if (pc.map.find(x.first) != pc.map.end()) continue;
+            SNAPSHOT_ENTRY *e = x.second;
+            write_entry(f, len, x.first, e->list(), e->n);
+        }
+    }
+    if (fclose(f) || rename(tmp.c_str(), fname)) {
+        printf("can't write %s\n", fname);
     }
 }
@@ -2,7 +2,10 @@
 #define WORDS_H
 
 #include <vector>
+#include <list>
 #include <map>
+#include <string>
+#include <cstdint>
 #include <unordered_set>
 #include <unordered_map>
 
@@ -21,21 +24,231 @@ typedef vector<char*> WLIST;
     // a list of words
 typedef unordered_set<string> WSET;
     // a set of (vetoed) words; constant-time lookup
-typedef vector<int> ILIST;
-    // a list of indices into a WLIST (i.e. a subset of the words)
+
+// a list of indices into a WLIST (i.e. a subset of the words).
+// Lists in the pattern cache also have, for each position,
+// a bitmask of the letters (a=bit 0) that occur there in some word
+//
+struct PATTERN_CACHE;
+
+struct ILIST : vector<int> {
+    unsigned int letter_mask[MAX_LEN];
+
+    // cache bookkeeping
+    int len;
+    PATTERN_CACHE *cache;
+        // the cache that owns this list
+    const string *key;
+    size_t nbytes;
+        // approximate memory used by the cache entry
+    int npins;
+        // number of slots whose compatible list this is.
+        // If zero, the list is in the LRU list and can be evicted
+    list<ILIST*>::iterator lru_pos;
+
+    vector<int> letter_count;
+        // letter_count[pos*26 + c-'a']: number of words with c at pos.
+        // Computed on first use (see count_letter())
+
+    void compute_letter_masks(int len, WLIST &wlist);
+    inline bool has_letter(int pos, char c) {
+        return (letter_mask[pos] >> (c-'a')) & 1;
+    }
+    void compute_letter_counts();
+    inline int count_letter(int pos, char c) {
+        if (letter_count.empty()) compute_letter_counts();
+        return letter_count[pos*26 + c-'a'];
+    }
+};
+
+// Words are also stored packed, 5 bits per letter (a=1),
+// 12 letters per 64-bit lane.
+// A pattern compiles to a (mask, value) pair per lane;
+// a word matches if (lane & mask) == value in every lane.
+//
+#define PACKED_LANES(len) (((len)+11)/12)
+#define MAX_LANES PACKED_LANES(MAX_LEN)
+
+inline uint64_t letter_code(char c) {
+    return (c>='a' && c<='z')?(c-'a'+1):0;
+}
+
+struct PACKED_PATTERN {
+    int nlanes;
+    uint64_t mask[MAX_LANES];
+    uint64_t value[MAX_LANES];
+
+    void compile(int len, const char* pattern) {
+        nlanes = PACKED_LANES(len);
+        for (int k=0; k<nlanes; k++) {
+            mask[k] = value[k] = 0;
+        }
+        for (int j=0; j<len; j++) {
+            char c = pattern[j];
+            if (c == '_') continue;
+            int shift = (j%12)*5;
+            mask[j/12] |= (uint64_t)0x1f << shift;
+            value[j/12] |= letter_code(c) << shift;
+        }
+    }
+    inline bool match(const uint64_t *w) {
+        uint64_t d = 0;
+        for (int k=0; k<nlanes; k++) {
+            d |= (w[k] & mask[k]) ^ value[k];
+        }
+        return d == 0;
+    }
+};
+
+typedef vector<uint64_t> BITSET;
+    // a set of indices into a WLIST, 64 per block
+
+// for the words of a given length,
+// a bitset for each (position, letter) saying which words
+// have that letter in that position.
+// The words matching a pattern are the AND of the bitsets
+// of its non-wildcard positions.
+//
+struct LETTER_INDEX {
+    int len;
+    int nwords;
+    int nblocks;
+        // 64-bit blocks per bitset
+    BITSET bits;
+        // len*26 bitsets, each of nblocks
+
+    void build(int _len, WLIST &wlist);
+    inline uint64_t* letter_bits(int pos, char c) {
+        return &bits[(pos*26 + (c-'a'))*nblocks];
+    }
+    void match_bits(char* pattern, BITSET &out);
+    bool any_match(char* pattern);
+    int count_matches(char* pattern);
+};
+
+#define DEFAULT_WORD_SCORE 50
+
+// Compiled word lists (see xwdict.cpp).
+// A header, then for each length with words, a block with
+// the packed words, their scores (int), and the words
+// as consecutive NUL-terminated strings.
+// Words are deduplicated and vetoes are applied.
+// The solver maps the file and loads the lengths its grid needs.
+//
+#define DICT_MAGIC "XWDICT\0\0"
+#define DICT_VERSION 1
+
+struct DICT_HEADER {
+    char magic[8];
+    int version;
+    int max_len;
+        // MAX_LEN of the program that wrote it
+    int reversed;
+        // compiled with --reverse
+    int pad;
+    struct {
+        uint64_t offset;
+            // of the block, from the start of the file; 8-byte aligned
+        int nwords;
+        int pad;
+    } lens[MAX_LEN+1];
+};
 
 struct WORDS {
     WLIST words[MAX_LEN+1];
+        // pointers into 'arena'
+    vector<char> chars[MAX_LEN+1];
+    vector<uint64_t> packed[MAX_LEN+1];
+        // storage for words read from a text file
+    char *arena[MAX_LEN+1];
+        // the words of each length, as consecutive NUL-terminated strings;
+        // in 'chars' or in a mapped compiled list
+    uint64_t *packed_arena[MAX_LEN+1];
+        // the words of each length, PACKED_LANES(len) lanes per word;
+        // in 'packed' or in a mapped compiled list
+    vector<int> canon[MAX_LEN+1];
+        // canon[len][i]: the index of the first word equal to word i.
+        // Words can appear twice (e.g. palindromes with --reverse)
+    int max_copies[MAX_LEN+1];
+        // the most times any word of the length appears
+    vector<int> score[MAX_LEN+1];
+        // score[len][i]: the quality of word i, from a 'word;score' line
+        // in the word list (DEFAULT_WORD_SCORE if none)
+    LETTER_INDEX index[MAX_LEN+1];
     WSET vetoed_words[MAX_LEN+1];
     bool have_vetoed_words[MAX_LEN+1];
     int nwords[MAX_LEN+1];
     int max_len;
+
+    // compiled lists
+    char *map_addr;
+    size_t map_size;
+        // the mapped file, or NULL
+    bool loaded[MAX_LEN+1];
+        // length is loaded from the mapped file
+    bool needed[MAX_LEN+1];
+        // length is used by the grid (see need_length())
+
     void read(const char* fname, bool reverse_words);
+    void read_dict(const char* fname, bool reverse_words);
+    void write_dict(const char* fname, bool reverse_words);
+    void unmap();
+    void need_length(int len);
+    void load_length(int len);
     void read_veto_file(const char* fname);
     void print_vetoed_words();
     void print_counts();
-    void shuffle();
+    void build_arena(int len);
+    void build_index();
+    inline uint64_t* packed_word(int len, int i) {
+        return &packed_arena[len][i*PACKED_LANES(len)];
+    }
+    inline char word_char(int len, int i, int pos) {
+        return arena[len][i*(len+1) + pos];
+    }
+};
+
+// The order in which a search tries words.
+// Lists from the pattern cache are sorted by rank;
+// if there are no ranks (the default), they're in word-list order.
+// Concurrent searches can use different orders
+// with the same word lists.
+//
+struct WORD_ORDER {
+    vector<int> rank[MAX_LEN+1];
+        // rank[len][i]: the position of word i in the order
+
+    void shuffle(unsigned int seed);
+    void sort_by_score();
+    void clear() {
+        for (int i=0; i<=MAX_LEN; i++) rank[i].clear();
+    }
+};
+// The pattern caches of all lengths share a memory budget.
+// Lists that are some slot's compatible list are 'pinned';
+// the others are kept in LRU order, and the least recently used
+// are evicted when adding a list would exceed the budget.
+//
+struct CACHE_BUDGET {
+    size_t max_bytes;
+        // zero means no limit
+    size_t nbytes;
+    list<ILIST*> lru;
+        // unpinned lists, most recently used first
+    long nhits, nmisses, nevictions;
+    long nsnapshot;
+        // misses satisfied from the snapshot (see PATTERN_SNAPSHOT)
+
+    CACHE_BUDGET() {
+        max_bytes = 0;
+        nbytes = 0;
+        nhits = nmisses = nevictions = nsnapshot = 0;
+    }
+    void make_room(size_t n);
+    void print_stats(FILE*);
 };
+extern void pin_list(ILIST*);
+extern void unpin_list(ILIST*);
 
 // for a list of words of given len,
 // cache a mapping of pattern -> word index list
@@ -44,19 +257,125 @@ struct PATTERN_CACHE {
     int len;
     WLIST *wlist;
     unordered_map<string, ILIST*> map;
+    CACHE_BUDGET *budget;
+    WORD_ORDER *order;
 
-    void init(int _len, WLIST *_wlist) {
+    PATTERN_CACHE() {
+        len = 0;
+        wlist = NULL;
+        budget = NULL;
+        order = NULL;
+    }
+    void init(int _len, WLIST *_wlist, CACHE_BUDGET *_budget, WORD_ORDER *_order) {
         len = _len;
         wlist = _wlist;
-        map.clear();
+        budget = _budget;
+        order = _order;
+        clear();
     }
+    void clear();
+    ILIST* lookup(const string &key);
+    void insert(const string &key, ILIST* ilist);
     ILIST* get_matches(char* pattern);
+    void index_matches(char* pattern, ILIST &ilist);
+    void sort_by_rank(ILIST &ilist);
+    ILIST* get_matches_refine(ILIST* parent, char* pattern, int pos);
+    ILIST* get_matches_restrict(ILIST* parent, int pos, unsigned int mask);
+    ILIST* get_matches_mword(char* pattern, unsigned int free_mask);
+    ILIST* get_matches_mword_refine(
+        ILIST* parent, char* pattern, int pos, unsigned int free_mask
+    );
     ILIST* get_matches_prune(
         ILIST* ilist, int& next_index,
         string &prune_signature, char* prune_pattern
     );
 };
-extern PATTERN_CACHE pattern_cache[MAX_LEN];
+
+// A search's private overlay on the shared word lists and letter index:
+// its word order, and the pattern lists (including prune lists)
+// it has computed, with their budget.
+// The shared structures (WORDS) are read-only during searches,
+// so any number of searches, in any threads, can use them without locks.
+// Don't copy these; the pattern caches point to the budget and order.
+//
+struct SEARCH_CACHE {
+    WORD_ORDER order;
+    CACHE_BUDGET budget;
+    PATTERN_CACHE pattern_cache[MAX_LEN+1];
+
+    SEARCH_CACHE() {
+        init();
+    }
+    SEARCH_CACHE(const SEARCH_CACHE&) = delete;
+    SEARCH_CACHE& operator=(const SEARCH_CACHE&) = delete;
+    ~SEARCH_CACHE();
+
+    // free all lists; call this after the word lists or order change.
+    // Slots must not be using any of the lists
+    //
+    void init();
+};
+
+// A snapshot of pattern lists (--pattern_snapshot):
+// written at the end of a run, mapped at the start of the next,
+// so the lists needn't be computed again.
+// Lists are stored in word-list order; a search sorts them
+// into its own word order when it loads them, so any order can use them.
+// A length's lists are valid only for the words they were computed from;
+// the header has a checksum of the words of each length.
+// Prune lists aren't saved; they depend on the search path.
+// Nor are mword lists; which word represents each mword
+// depends on the word order.
+//
+#define SNAPSHOT_MAGIC "XWSNAP\0\0"
+#define SNAPSHOT_VERSION 1
+
+struct SNAPSHOT_HEADER {
+    char magic[8];
+    int version;
+    int max_len;
+    uint64_t checksum[MAX_LEN+1];
+};
+
+// followed by the key (padded to a multiple of 4 bytes)
+// and the list (n ints)
+//
+struct SNAPSHOT_ENTRY {
+    int len;
+    int keylen;
+    int n;
+
+    inline const char* key() {
+        return (const char*)(this+1);
+    }
+    inline const int* list() {
+        return (const int*)(key() + ((keylen+3) & ~3));
+    }
+    inline size_t size() {
+        return sizeof(SNAPSHOT_ENTRY) + ((keylen+3) & ~3) + n*sizeof(int);
+    }
+};
+
+struct PATTERN_SNAPSHOT {
+    char *map_addr;
+    size_t map_size;
+        // the mapped file, or NULL
+    unordered_map<string, SNAPSHOT_ENTRY*> index[MAX_LEN+1];
+    bool valid[MAX_LEN+1];
+        // the words of this length haven't changed since the snapshot.
+        // Set by check()
+
+    PATTERN_SNAPSHOT() {
+        map_addr = NULL;
+        map_size = 0;
+        for (int i=0; i<=MAX_LEN; i++) valid[i] = false;
+    }
+    void read(const char* fname);
+    void check();
+    ILIST* get(int len, const string &key);
+    void write(const char* fname, SEARCH_CACHE&);
+};
+extern PATTERN_SNAPSHOT snapshot;
 
 // does word match pattern?
 //
@@ -68,6 +387,5 @@ inline bool match(int len, char *pattern, char* word) {
 }
 
 extern WORDS words;
-extern void init_pattern_cache();
 
 #endif
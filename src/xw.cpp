@@ -1,61 +1,18 @@
 // xw: fill generalized crossword puzzle grids.
-// Enumerates all solutions for a given grid.
+// The search: slots, grids, and their algorithms.
+// This and words.cpp are the solver library (libxw);
+// the command-line program is in xw_main.cpp.
 // copyright (C) 2025 David P. Anderson
 
 #include <cstdio>
 #include <cstring>
+#include <ctime>
 #include <sys/time.h>
-#include <sys/types.h>
 #include <sys/resource.h>
-#include <unistd.h>
+#include <string>
 
 #include "xw.h"
 
-const char* options = "\
-options:\n\
---allow_dups        allow duplicate words\n\
---backjump          backtrack over multiple slots\n\
---curses            show partial solutions with curses\n\
---grid_file f       use the given grid file in ../grids\n\
---help              show options\n\
---max_time x        give up after x CPU seconds\n\
---perf              on 1st solution, print JSON info and exit\n\
---prune             prune compatible word lists\n\
---reverse           allow words to be reversed\n\
---show_grid         show grid details at start\n\
---shuffle           shuffle words with nondeterministic seed\n\
---solution_file f   write solutions to f (default 'solution')\n\
---step_period n     show partial solution and check CPU time every n changes\n\
---verbose           show each slot and word addition\n\
---verbose_slot      show slot selection details\n\
---verbose_word      show word selection details\n\
---verbose_prune     show pruning details\n\
---veto_file f       use given veto file (default 'vetoed_words')\n\
---word_list f       use given word list\n\
-";
-
-// This must be linked with two grid-type-specific functions:
-
-extern void make_grid(const char* &filename, GRID&);
-    // read the given file and populate the GRID structure.
-    // We supply two variants:
-    // black-square format (NYT type puzzles)
-    // line-grid format (Atlantic cryptic type puzzles)
-extern void print_grid(GRID&, bool curses, FILE *f);
-    // print the (partially-filled) grid
-    // if curses is true, use curses
-    // else write to the given FILE*
-
-// files
-const char* grid_file = NULL;
-const char* veto_fname = "vetoed_words";
-const char* solution_fname = "solutions";
-const char* word_list = "../words/words";
-
-// algorithm
-bool do_prune = false;
-bool do_backjump = false;
-
 // debugging output
 bool verbose = false;
     // at start, show list of slots (num, across/down, row/col, len)
@@ -70,17 +27,11 @@ bool verbose_slot = false;
     // for unfilled slots, show word count and filled_pattern
 bool verbose_prune = false;
     // on backtrack, show pruning info
-bool curses = false;
-int step_period = 10000;
-double max_time = 0;
-bool perf = false;
-
-// behavior
-bool shuffle = false;
-bool reverse_words = false;
-bool allow_dups = false;
+bool verbose_propagate = false;
+    // show list reductions and failures from propagation
 
-FILE* solution_file;
+atomic<int> slot_num(0);
+    // grids may be made in several threads
 
 double get_cpu_time() {
     struct rusage ru;
@@ -89,40 +40,13 @@ double get_cpu_time() {
         + (double)ru.ru_stime.tv_sec + ((double)ru.ru_stime.tv_usec) / 1e6;
 }
 
-char* date_str() {
-    static char buf[256];
-    time_t t = time(0);
-    strcpy(buf, ctime(&t));
-    buf[strlen(buf)-1] = 0;
-    return buf;
-}
-
-void print_params() {
-    printf("date: %s\n", date_str());
-    printf("grid file: %s\n", grid_file);
-    printf("word list: %s\n", word_list);
-    words.print_vetoed_words();
-    printf("backjump: %s\n", do_backjump?"yes":"no");
-    printf("prune: %s\n", do_prune?"yes":"no");
-    printf("reverse: %s\n", reverse_words?"yes":"no");
-    printf("allow dups: %s\n", allow_dups?"yes":"no");
-}
-
-void print_perf_json(int nsteps, double et) {
-    printf("{\n\
-        \"success\": 1,\n\
-        \"nsteps\": %d,\n\
-        \"cpu_time\": %f\n\
-}\n",
-        nsteps, et
-    );
-}
-
-void print_fail_json() {
-    printf("{\n\
-        'success': 0;\n\
-}\n"
-    );
+// CPU time of the calling thread;
+// get_cpu_time() includes that of all the threads
+//
+double get_thread_cpu_time() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec/1e9;
 }
 
 ///////////////// SLOT ///////////////////////
@@ -148,9 +72,11 @@ bool SLOT::prune() {
     }
     if (!found) return false;
 
-    compatible_words = pattern_cache[len].get_matches_prune(
+    // the pruned list is restored when a lower slot is uninstalled
+    //
+    grid->set_list_trail(this, grid->pattern_cache(len).get_matches_prune(
         compatible_words, next_word_index, prune_signature, prune_pattern
-    );
+    ));
     return true;
 }
 
@@ -161,31 +87,45 @@ bool SLOT::prune() {
 void SLOT::prepare_slot() {
     preset_pattern[len] = 0;
     strcpy(filled_pattern, preset_pattern);
+    nopen = 0;
+    free_mask = 0;
+    for (int i=0; i<len; i++) {
+        if (filled_pattern[i] != '_') continue;
+        if (!links[i].empty()) {
+            nopen++;
+        } else if (grid->use_mwords) {
+            free_mask |= 1 << i;
+        }
+    }
 
     if (strchr(filled_pattern, '_')) {
-        compatible_words = pattern_cache[len].get_matches(filled_pattern);
+        PATTERN_CACHE &pc = grid->pattern_cache(len);
+        set_compatible_words(free_mask
+            ?pc.get_matches_mword(filled_pattern, free_mask)
+            :pc.get_matches(filled_pattern)
+        );
         filled = false;
     } else {
-        compatible_words = NULL;
+        set_compatible_words(NULL);
         strcpy(current_word, filled_pattern);
         filled = true;
     }
     sprintf(name, "%c(%d,%d)", is_across?'A':'D', row, col);
 }
 
-// debugging
+// debugging: for each crossed position, show the letters
+// allowed by the crossing slot
+//
 void SLOT::print_usable() {
-    printf("usable checked:\n");
+    printf("usable letters:\n");
     for (int i=0; i<len; i++) {
-        for (int j=0; j<26; j++) {
-            printf("%d", usable_letter_checked[i][j]);
+        printf("%2d: ", i);
+        if (links[i].empty() || links[i].other_slot->filled) {
+            printf("any\n");
+            continue;
         }
-        printf("\n");
-    }
-    printf("usable ok:\n");
-    for (int i=0; i<len; i++) {
         for (int j=0; j<26; j++) {
-            printf("%d", usable_letter_ok[i][j]);
+            printf("%d", letter_compatible(i, 'a'+j));
         }
         printf("\n");
     }
@@ -276,21 +216,31 @@ void SLOT::print_state(bool show_links) {
 //      return true
 //
 // Efficiency trick:
-// For each linked position and each possible letter (a-z) either
-// - we haven't checked it yet
-// - we checked and it's OK (the linked slot had compatible words)
-// - we checked and it's not OK
-//
-// so when scanning words:
-//  for each letter
-//      if not checked, check it
-//      if not OK, skip word
+// each compatible list has, for each position, a bitmask of
+// the letters that occur there.
+// So checking a letter in a crossed position is a bit test
+// in the crossing slot's list.
 //
-bool SLOT::find_next_usable_word(GRID *grid) {
+bool SLOT::find_next_usable_word() {
     if (!compatible_words) return false;
+    bool do_prune = grid->do_prune;
+    bool do_cbj = grid->do_cbj;
+    bool allow_dups = grid->allow_dups;
+    bool do_lcv = grid->do_lcv;
     if (next_word_index == 0) {
-        clear_usable_letter_checked();
+        dup_stack_level = -1;
+        if (do_cbj) {
+            conflicts.clear();
+        }
+        if (do_prune) {
+            memset(prune_letters_checked, 0, sizeof(prune_letters_checked));
+        }
+        if (do_lcv) {
+            lcv_order();
+        }
     }
+    vector<int> &canon = words.canon[len];
+    vector<int> &word_level = grid->word_level[len];
     int n = compatible_words->size();
     if (verbose_word) {
         printf("find_next_usable_word() slot %d: %d of %d\n",
@@ -299,42 +249,75 @@ bool SLOT::find_next_usable_word(GRID *grid) {
         printf("   stack pattern %s\n", filled_pattern);
     }
     while (next_word_index < n) {
-        int ind = (*compatible_words)[next_word_index++];
+        int ind = (*compatible_words)[do_lcv?lcv_next():next_word_index];
+        next_word_index++;
         char* w = words.words[len][ind];
         if (verbose_word) {
             printf("   checking %s\n", w);
         }
+        if (!allow_dups && canon[ind] != ind) {
+            // a second copy of a word; trying it would repeat the first
+            continue;
+        }
         bool usable = true;
         for (int i=0; i<len; i++) {
             if (links[i].empty()) continue;
             if (filled_pattern[i] != '_') continue;
             char c = w[i];
-            int nc = c-'a';
-            if (!usable_letter_checked[i][nc]) {
-                usable_letter_checked[i][nc] = true;
-                bool x = letter_compatible(i, c);
-                usable_letter_ok[i][nc] = x;
+            if (do_prune) {
+                unsigned int bit = 1 << (c-'a');
+                if (!(prune_letters_checked[i] & bit)) {
+                    prune_letters_checked[i] |= bit;
+                    links[i].other_slot->mark_crossings_ref_by_higher();
+                }
+            }
+            bool x = letter_compatible(i, c);
 #if CHECK_ASSERTS
-            } else {
-                bool x = letter_compatible(i, c);
-                if (x != usable_letter_ok[i][nc]) {
+            LINK &link = links[i];
+            if (!link.other_slot->filled) {
+                char pattern2[MAX_LEN];
+                strcpy(pattern2, link.other_slot->filled_pattern);
+                pattern2[link.other_pos] = c;
+                if (x != link.other_slot->check_pattern(pattern2)) {
                     printf("USABLE inconsistent flag i %d char %c x %d mw %s\n", i, c, x, w);
                     exit(1);
                 }
-#endif
             }
-            if (!usable_letter_ok[i][nc]) {
+#endif
+            if (!x) {
                 usable = false;
+                if (do_cbj) {
+                    links[i].other_slot->add_crossing_conflicts(conflicts);
+                }
                 break;
             }
         }
-        if (!allow_dups) {
-            for (SLOT *s2: grid->filled_slots) {
-                if (!strcmp(w, s2->current_word)) {
-                    usable = false;
-                    dup_stack_level = s2->stack_level;
-                    break;
+        if (!allow_dups && !free_mask && word_level[ind] >= 0) {
+            if (usable && do_cbj) {
+                conflicts.add(word_level[ind]);
+            }
+            if (usable && grid->do_components) {
+                grid->note_dup(word_level[ind]);
+            }
+            usable = false;
+            dup_stack_level = word_level[ind];
+        }
+        if (usable && free_mask && !allow_dups) {
+            // the filled mword slots of this length, and this one,
+            // must still have distinct words
+            strcpy(current_word, w);
+            if (!grid->match_words(len, this, false)) {
+                // we don't track which slots used the words,
+                // so blame all the levels (cbj) or the top one.
+                // A dup level also keeps this out of the nogood store
+                //
+                if (do_cbj) {
+                    conflicts.add_below(grid->filled_slots.size());
                 }
+                int top = (int)grid->filled_slots.size() - 1;
+                if (top > dup_stack_level) dup_stack_level = top;
+                if (dup_stack_level < 0) dup_stack_level = 0;
+                usable = false;
             }
         }
         if (usable) {
@@ -343,6 +326,7 @@ bool SLOT::find_next_usable_word(GRID *grid) {
                 //print_usable();
             }
             strcpy(current_word, w);
+            word_index = canon[ind];
             return true;
         }
     }
@@ -353,34 +337,156 @@ bool SLOT::find_next_usable_word(GRID *grid) {
     return false;
 }
 
-// see if given letter in given crossed position is compatible with xword
+// Least-constraining-value ordering (--lcv).
+// A word's score is the product, over unfilled crossing slots,
+// of the number of words in the crossing slot's list
+// that have the word's letter at the crossing,
+// i.e. the sizes of their lists if we install the word.
+// Words with score 0 aren't usable; they go last, and are rejected
+// (and charged to conflict sets) in the usual way.
+// We put the scores in a priority queue and pop them one at a time,
+// so if an early word works we don't pay for a full sort
+//
+void SLOT::lcv_order() {
+    vector<LCV_ENTRY> v(compatible_words->size());
+    vector<int> &list = *compatible_words;
+    for (unsigned int i=0; i<list.size(); i++) {
+        char *w = words.words[len][list[i]];
+        double score = 1;
+        for (int j=0; j<len; j++) {
+            LINK &link = links[j];
+            if (link.empty()) continue;
+            SLOT *slot2 = link.other_slot;
+            if (slot2->filled) continue;
+            score *= slot2->compatible_words->count_letter(
+                link.other_pos, w[j]
+            );
+            if (score == 0) break;
+        }
+        v[i].score = score;
+        v[i].pos = i;
+    }
+    lcv_queue = decltype(lcv_queue)(LCV_LESS(), std::move(v));
+}
+
+// the list position of the best word not yet tried
+//
+int SLOT::lcv_next() {
+    int pos = lcv_queue.top().pos;
+    lcv_queue.pop();
+    return pos;
+}
+
+// We're checking letters against this (unfilled) slot's compatible list,
+// which depends on the filled slots crossing it.
+// Mark those cells as referenced by the higher slot
+//
+void SLOT::mark_crossings_ref_by_higher() {
+    if (filled) return;
+    for (int i=0; i<len; i++) {
+        LINK &link = links[i];
+        if (link.empty()) continue;
+        SLOT* slot2 = link.other_slot;
+        if (!slot2->filled) continue;
+        slot2->ref_by_higher[link.other_pos] = true;
+    }
+}
+
+// This slot's list rejected a word.
+// Add the levels of the filled slots crossing it,
+// which determine its list, to the conflict set.
+// If propagating, the list also depends on the lists of other slots;
+// we don't keep track of which, so add all the levels
+//
+void SLOT::add_crossing_conflicts(CONFLICT_SET &c) {
+    if (grid->do_propagate) {
+        c.add_below(grid->filled_slots.size());
+        return;
+    }
+    for (int i=0; i<len; i++) {
+        LINK &link = links[i];
+        if (link.empty()) continue;
+        SLOT* slot2 = link.other_slot;
+        if (!slot2->filled) continue;
+        c.add(slot2->stack_level);
+    }
+}
+
+// This (unfilled) slot is in a nogood state.
+// Add the levels of the filled slots that determine that state:
+// those crossing it or crossing its unfilled crossing slots
+//
+void SLOT::add_nogood_conflicts(CONFLICT_SET &c) {
+    add_crossing_conflicts(c);
+    for (int i=0; i<len; i++) {
+        LINK &link = links[i];
+        if (link.empty()) continue;
+        SLOT* slot2 = link.other_slot;
+        if (slot2->filled) continue;
+        slot2->add_crossing_conflicts(c);
+    }
+}
+
+// hash of the state of this (unfilled) slot:
+// its index, its pattern, and the patterns of its unfilled crossing slots.
+// Letters of filled crossing slots are already in our pattern.
+// FNV-1a, 64 bits
+//
+uint64_t SLOT::state_hash() {
+    uint64_t h = 14695981039346656037ULL;
+    const uint64_t prime = 1099511628211ULL;
+    h = (h ^ (uint64_t)num) * prime;
+    for (int i=0; i<len; i++) {
+        h = (h ^ (unsigned char)filled_pattern[i]) * prime;
+    }
+    for (int i=0; i<len; i++) {
+        LINK &link = links[i];
+        if (link.empty()) continue;
+        SLOT* slot2 = link.other_slot;
+        if (slot2->filled) continue;
+        h = (h ^ (uint64_t)(i+256)) * prime;
+        for (int j=0; j<slot2->len; j++) {
+            h = (h ^ (unsigned char)slot2->filled_pattern[j]) * prime;
+        }
+    }
+    return h;
+}
+
+// The filled pattern is complete, but the compatible list
+// is still that of the pattern before the last letter was added.
+// Return the canonical index of the word in the list that matches
 //
-bool SLOT::letter_compatible(int pos, char c) {
-    LINK &link = links[pos];
-    SLOT* slot2 = link.other_slot;
-    if (slot2->filled) return true;
-    char pattern2[MAX_LEN];
-    strcpy(pattern2, slot2->filled_pattern);
-    pattern2[link.other_pos] = c;
-    return slot2->check_pattern(pattern2);
+int SLOT::find_word_index() {
+    PACKED_PATTERN pp;
+    pp.compile(len, filled_pattern);
+    for (int i: *compatible_words) {
+        if (pp.match(words.packed_word(len, i))) {
+            return words.canon[len][i];
+        }
+    }
+    printf("slot %d: no word matches %s\n", num, filled_pattern);
+    exit(1);
 }
 
 // p differs from current filled pattern by 1 additional letter.
 // see if this slot has an compatible word matching this
-// (only need to check words compatible with current filled_pattern)
+// (only need to check words compatible with current filled_pattern).
+// Used to check the letter masks
 //
 bool SLOT::check_pattern(char* p) {
-    if (do_prune) {
-        for (int i=0; i<len; i++) {
-            LINK &link = links[i];
-            if (link.empty()) continue;
-            SLOT* slot2 = link.other_slot;
-            if (!slot2->filled) continue;
-            slot2->ref_by_higher[link.other_pos] = true;
-        }
+    // p is at least as specific as filled_pattern,
+    // so matching against the whole word list gives the same answer
+    // (unless propagation has reduced the list).
+    // Use the letter index if that's cheaper than scanning the list.
+    //
+    LETTER_INDEX &index = words.index[len];
+    if (!grid->do_propagate && (int)compatible_words->size() > index.nblocks) {
+        return index.any_match(p);
     }
+    PACKED_PATTERN pp;
+    pp.compile(len, p);
     for (int i: *compatible_words) {
-        if (match(len, p, words.words[len][i])) {
+        if (pp.match(words.packed_word(len, i))) {
             return true;
         }
     }
@@ -396,32 +502,15 @@ bool SLOT::check_pattern(char* p) {
 //      compat lists of unfilled slots are updated and nonempty
 //
 bool GRID::push_next_slot() {
-    // find unfilled slot with smallest compatible set
-    //
-    size_t nbest = 9999999;
-    SLOT* best=0;
-    if (verbose_slot) {
-        printf("push_next_slot():\n");
-    }
-    for (SLOT* slot: slots) {
-        if (slot->filled) continue;
-        size_t n = slot->compatible_words->size();
-        if (verbose_slot) {
-            printf("   slot %s, %ld compatible words\n",
-                slot->name, n
-            );
-        }
-        if (n < nbest) {
-            nbest = n;
-            best = slot;
-        }
+    if (do_components && !next_component()) {
+        return false;
     }
-#if CHECK_ASSERTS
+    SLOT *best = select_slot();
     if (!best) {
-        printf("no unfilled slot\n");
-        exit(1);
+        // the components filled the grid;
+        // the caller's solution check will see it
+        return true;
     }
-#endif
 
     if (do_prune) {
         // set ref_by_higher in crossed filled slots
@@ -437,46 +526,194 @@ bool GRID::push_next_slot() {
     }
 
     best->next_word_index = 0;
-    if (best->find_next_usable_word(this)) {
+    if (do_nogoods && nogoods.lookup(best->state_hash())) {
+        if (verbose) {
+            printf("slot %s is in a nogood state\n", best->name);
+        }
+        best->dup_stack_level = -1;
+        if (do_cbj) {
+            best->conflicts.clear();
+            best->add_nogood_conflicts(best->conflicts);
+            if (!conflict_jump(best, filled_slots.size())) {
+                while (filled_slots.size() > floor_level) {
+                    pop_slot();
+                }
+            }
+        }
+        return false;
+    }
+    if (best->find_next_usable_word()) {
         if (verbose_slot) {
             printf("   slot %s has usable words\n", best->name);
         }
-        best->filled = true;
-#if CHECK_ASSERTS
-        if (find(filled_slots.begin(), filled_slots.end(), best) != filled_slots.end()) {
-            printf("slot %d is already in filled stack\n", best->num);
-            exit(1);
-        }
-#endif
-        // push slot on filled stack
+        // if propagation fails, the slot is pushed anyway;
+        // backtrack() will try its next word
         //
-        best->stack_level = filled_slots.size();
-        filled_slots.push_back(best);
-        best->prune_signature = best->filled_pattern;
-        if (verbose) {
-            printf("pushing slot %s\n", best->name);
-        }
-
-        install_word(best);
-        return true;
+        return push_slot(best);
     } else {
         if (verbose) {
             printf("slot %s has no usable words\n", best->name);
         }
+        if (do_nogoods && best->dup_stack_level < 0) {
+            // the failure didn't involve duplicates,
+            // so it depends only on the slot's state
+            //
+            nogoods.insert(best->state_hash());
+        }
+        if (do_cbj) {
+            // jump to the culprit; backtrack() will try its next word
+            if (!conflict_jump(best, filled_slots.size())) {
+                while (filled_slots.size() > floor_level) {
+                    pop_slot();
+                }
+            }
+        }
         return false;
     }
 }
 
+// find unfilled slot with smallest compatible set
+// (the first in 'slots' if there's a tie).
+// It's the top of the slot heap,
+// or with --components the best in the current component
+//
+SLOT* GRID::select_slot() {
+    SLOT* best = scope_top();
+    if (verbose_slot) {
+        printf("push_next_slot():\n");
+        for (SLOT* slot: slots) {
+            if (slot->filled) continue;
+            printf("   slot %s, %ld compatible words\n",
+                slot->name, slot->ncompatible()
+            );
+        }
+    }
+#if CHECK_ASSERTS
+    if (!best) {
+        printf("no unfilled slot\n");
+        exit(1);
+    }
+    for (SLOT* slot: slots) {
+        if (slot->filled) continue;
+        if (slot->ncompatible() < best->ncompatible()) {
+            printf("slot heap: %s is not the best slot\n", best->name);
+            exit(1);
+        }
+    }
+#endif
+    return best;
+}
+
+///////////////// SLOT_HEAP
+
+void SLOT_HEAP::clear() {
+    for (SLOT *s: heap) {
+        s->heap_pos = -1;
+    }
+    heap.clear();
+}
+
+void SLOT_HEAP::insert(SLOT *slot) {
+    heap.push_back(slot);
+    slot->heap_pos = heap.size()-1;
+    sift_up(slot->heap_pos);
+}
+
+void SLOT_HEAP::remove(SLOT *slot) {
+    int pos = slot->heap_pos;
+    SLOT *last = heap.back();
+    heap.pop_back();
+    slot->heap_pos = -1;
+    if (last == slot) return;
+    set(pos, last);
+    update(last);
+}
+
+// the slot's key changed; restore the heap property
+//
+void SLOT_HEAP::update(SLOT *slot) {
+    int pos = slot->heap_pos;
+    if (pos > 0 && less(slot, heap[(pos-1)/2])) {
+        sift_up(pos);
+    } else {
+        sift_down(pos);
+    }
+}
+
+void SLOT_HEAP::sift_up(int pos) {
+    SLOT *slot = heap[pos];
+    while (pos > 0) {
+        int parent = (pos-1)/2;
+        if (!less(slot, heap[parent])) break;
+        set(pos, heap[parent]);
+        pos = parent;
+    }
+    set(pos, slot);
+}
+
+void SLOT_HEAP::sift_down(int pos) {
+    SLOT *slot = heap[pos];
+    int n = heap.size();
+    while (1) {
+        int child = 2*pos+1;
+        if (child >= n) break;
+        if (child+1 < n && less(heap[child+1], heap[child])) child++;
+        if (!less(heap[child], slot)) break;
+        set(pos, heap[child]);
+        pos = child;
+    }
+    set(pos, slot);
+}
+
+// we've chosen a word (current_word) for the given unfilled slot.
+// Push it on the filled stack and install the word.
+// Return false if propagation found a dead end
+//
+bool GRID::push_slot(SLOT *slot) {
+    slot->filled = true;
+    slot_heap.remove(slot);
+#if CHECK_ASSERTS
+    if (find(filled_slots.begin(), filled_slots.end(), slot) != filled_slots.end()) {
+        printf("slot %d is already in filled stack\n", slot->num);
+        exit(1);
+    }
+#endif
+    slot->stack_level = filled_slots.size();
+    filled_slots.push_back(slot);
+    slot->prune_signature = slot->filled_pattern;
+    if (verbose) {
+        printf("pushing slot %s\n", slot->name);
+    }
+    return install_word(slot);
+}
+
+// uninstall the word of the top slot and pop it
+//
+void GRID::pop_slot() {
+    SLOT *slot = filled_slots.back();
+    slot->uninstall_word();
+    slot->filled = false;
+    slot_heap.insert(slot);
+    filled_slots.pop_back();
+}
+
 // we've found a usable word for the given slot.
 // for each position where its pattern was _:
 // in the linked slot, update the pattern and the compatible_words list.
-// If the pattern is full, mark slot as filled and push
+// If the pattern is full, mark slot as filled and push.
+// If propagating, then propagate the changed lists;
+// return false if some list becomes empty
 //
-void GRID::install_word(SLOT* slot) {
+bool GRID::install_word(SLOT* slot) {
     if (verbose) {
         printf("installing %s in slot %s\n", slot->current_word, slot->name);
     }
     nsteps++;
+    use_word(slot);
+    slot->trail_level = trail.size();
+    int dup_level = -1;
+        // if a slot filled by its crossings repeats a word,
+        // the level of the slot that used it first
     for (int i=0; i<slot->len; i++) {
         LINK &link = slot->links[i];
         if (link.empty()) continue;
@@ -484,9 +721,34 @@ void GRID::install_word(SLOT* slot) {
         if (c != '_') continue;
         SLOT *slot2 = link.other_slot;
         slot2->filled_pattern[link.other_pos] = slot->current_word[i];
-        if (strchr(slot2->filled_pattern, '_')) {
-            slot2->compatible_words = pattern_cache[slot2->len].get_matches(
-                slot2->filled_pattern
+        slot2->nopen--;
+        if (do_propagate && strchr(slot2->filled_pattern, '_')) {
+            // the current list may have been reduced by propagation,
+            // so reduce it further rather than starting from the pattern
+            //
+            char c2 = slot->current_word[i];
+            set_list_trail(slot2,
+                pattern_cache(slot2->len).get_matches_restrict(
+                    slot2->compatible_words, link.other_pos, 1<<(c2-'a')
+                ),
+                link.other_pos
+            );
+            enqueue(slot2);
+        } else if (strchr(slot2->filled_pattern, '_')) {
+            // the new list is a subset of the current one
+            //
+            PATTERN_CACHE &pc = pattern_cache(slot2->len);
+            set_list_trail(slot2,
+                slot2->free_mask
+                ?pc.get_matches_mword_refine(
+                    slot2->compatible_words, slot2->filled_pattern,
+                    link.other_pos, slot2->free_mask
+                )
+                :pc.get_matches_refine(
+                    slot2->compatible_words, slot2->filled_pattern,
+                    link.other_pos
+                ),
+                link.other_pos
             );
             if (slot2->compatible_words->empty()) {
                 printf("empty compat list for slot %d pattern %s\n",
@@ -507,86 +769,952 @@ void GRID::install_word(SLOT* slot) {
                     slot2->name, slot2->filled_pattern
                 );
             }
-            slot2->compatible_words = NULL;
+            slot2->word_index = slot2->find_word_index();
+            slot_heap.remove(slot2);
+            set_list_trail(slot2, NULL, link.other_pos);
+            slot2->trail_level = -1;
+            if (do_cbj) {
+                slot2->conflicts.clear();
+            }
             slot2->filled = true;
             strcpy(slot2->current_word, slot2->filled_pattern);
             slot2->stack_level = filled_slots.size();
             filled_slots.push_back(slot2);
+            use_word(slot2);
+            int level = word_level[slot2->len][slot2->word_index];
+            if (!allow_dups && level != slot2->stack_level && dup_level < 0) {
+                // any word with this letter here would repeat it too
+                dup_level = level;
+                if (do_prune) {
+                    slot->ref_by_higher[i] = true;
+                }
+            }
         }
     }
-    if (verbose) {
-        print_grid(*this, false, stdout);
+    if (verbose && grid_printer) {
+        grid_printer(*this, false, stdout);
     }
-}
-
-// We just popped this slot S from the stack.
-// Find the level of the topmost filled slot that affects it, i.e.
-// - had a dup word conflict
-// - intersects S
-// - intersects an unfilled slot that intersects S
-//
-// This is used for "backjumping": if we couldn't find a word for this slot,
-// we want to backtrack all the way to a slot that will make a difference
-//
-int SLOT::top_affecting_level() {
-    int max_level=-1;
-    if (dup_stack_level >= 0) {
-        max_level = dup_stack_level;
-        if (max_level == stack_level-1) return max_level;
+    if (dup_level >= 0) {
+        if (verbose) {
+            printf("a slot filled by its crossings repeats a word\n");
+        }
+        if (do_components) {
+            note_dup(dup_level);
+        }
+        if (do_cbj) {
+            slot->conflicts.add_below(slot->stack_level);
+        }
+        return false;
     }
-    for (int i=0; i<len; i++) {
-        LINK &link = links[i];
-        if (link.empty()) continue;
-        SLOT* slot2 = link.other_slot;
-        if (slot2->filled) {
-            if (slot2->stack_level > max_level) {
-                max_level = slot2->stack_level;
-                if (max_level == stack_level-1) return max_level;
-            }
-        } else {
-            for (int j=0; j<slot2->len; j++) {
-                LINK &link2 = slot2->links[j];
-                if (link2.empty()) continue;
-                SLOT* slot3 = link2.other_slot;
-                if (slot3->filled) {
-                    if (slot3->stack_level > max_level) {
-                        max_level = slot3->stack_level;
-                        if (max_level == stack_level-1) return max_level;
-                    }
+    if (do_propagate && !propagate()) {
+        if (do_cbj) {
+            // we don't know which levels caused the failure
+            slot->conflicts.add_below(slot->stack_level);
+        }
+        return false;
+    }
+    if (do_nogoods) {
+        // don't descend if a crossing slot is in a nogood state
+        //
+        for (int i=0; i<slot->len; i++) {
+            LINK &link = slot->links[i];
+            if (link.empty()) continue;
+            SLOT *slot2 = link.other_slot;
+            if (slot2->filled) continue;
+            if (nogoods.lookup(slot2->state_hash())) {
+                if (verbose) {
+                    printf("slot %s is in a nogood state\n", slot2->name);
                 }
+                if (do_cbj) {
+                    slot2->add_nogood_conflicts(slot->conflicts);
+                }
+                return false;
             }
         }
     }
-    return max_level;
+    if (do_matching && !allow_dups && !check_matching(slot)) {
+        if (do_components) {
+            note_dup(-1);
+        }
+        if (do_cbj) {
+            // we don't track which levels used the words
+            slot->conflicts.add_below(slot->stack_level);
+        }
+        return false;
+    }
+    if (maximize_score && have_best && score_bound() <= best_score) {
+        // nothing below here can beat the best solution so far
+        if (verbose) {
+            printf("score bound %d <= best score %d\n",
+                score_bound(), best_score
+            );
+        }
+        if (do_cbj) {
+            // the bound depends on all the levels
+            slot->conflicts.add_below(slot->stack_level);
+        }
+        return false;
+    }
+    return true;
 }
 
-// Remove a filled word.
-// Update filled_patterns of unfilled crossing slots
+// an upper bound on the score of any solution below the current state:
+// the score of the filled slots plus, for each unfilled slot,
+// the score of the first word in its list.
+// With --maximize_score the lists are in order of decreasing score,
+// so that's the best word that could go there
 //
-void SLOT::uninstall_word() {
-    if (verbose) {
-        printf("uninstalling %s from slot %s\n", current_word, name);
+int GRID::score_bound() {
+    int b = score;
+    for (SLOT *s: slots) {
+        if (s->filled) continue;
+        b += words.score[s->len][(*s->compatible_words)[0]];
     }
+    return b;
+}
+
+///////////////// MWORDS AND MATCHING
+//
+// With --mwords, a filled slot with unchecked cells stands for
+// all the words that match its word in its other cells.
+// When the grid is full, we pick one of these for each such slot
+// so that no word is used twice (or by a slot without unchecked cells).
+// This is a bipartite matching of slots to words;
+// we find it with augmenting paths.
+//
+// With --matching, the unfilled slots are in the matching too,
+// each with the unused words in its list.
+// If they can't all get distinct words, the partial fill can't be completed,
+// even though each slot still has usable words.
+// This also catches slots filled by their crossings with a used word,
+// which the per-word test in find_next_usable_word() doesn't see.
+// Slots of different lengths can't share words,
+// so each length is matched separately.
+// A slot whose list has at least (#slots in the matching + #used words)
+// distinct words can always get one, so it's left out.
+// Each slot remembers its matched word,
+// and the next matching starts from these where they're still valid.
+
+struct WORD_MATCHING {
+    vector<vector<int> > cand;
+        // for each slot, the unused words it can take
+    vector<int> match;
+        // for each slot, its word, or -1
+    unordered_map<int, int> owner;
+        // word -> slot
+    unordered_set<int> visited;
+
+    // find a word for slot j, maybe moving other slots to other words
+    //
+    bool augment(int j) {
+        for (int w: cand[j]) {
+            if (!visited.insert(w).second) continue;
+            auto it = owner.find(w);
+            if (it == owner.end() || augment(it->second)) {
+                owner[w] = j;
+                match[j] = w;
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+// the unused words this slot can take, for the matching:
+// - if it's filled (with an mword), those that match its word
+//   except in unchecked cells
+// - if it's unfilled, those in its list; for an mword slot,
+//   all the words that match its pattern and the list's letters
+//
+void SLOT::matching_candidates(vector<int> &cand) {
+    vector<int> &canon = words.canon[len];
+    vector<int> &level = grid->word_level[len];
+    PATTERN_CACHE &pc = grid->pattern_cache(len);
+    cand.clear();
+    if (!filled && !free_mask) {
+        for (int i: *compatible_words) {
+            if (canon[i] == i && level[i] < 0) {
+                cand.push_back(i);
+            }
+        }
+        return;
+    }
+    char pattern[MAX_LEN];
+    strcpy(pattern, filled?current_word:filled_pattern);
     for (int i=0; i<len; i++) {
-        LINK &link = links[i];
-        if (link.empty()) continue;
-        SLOT* slot2 = link.other_slot;
-        if (slot2->filled) continue;
-        slot2->filled_pattern[link.other_pos] = '_';
+        if ((free_mask >> i) & 1) pattern[i] = '_';
+    }
+    for (int i: *pc.get_matches(pattern)) {
+        if (canon[i] != i || level[i] >= 0) continue;
+        if (!filled) {
+            char *w = words.words[len][i];
+            bool ok = true;
+            for (int j=0; j<len; j++) {
+                if (pattern[j] != '_' || links[j].empty()) continue;
+                if (!((compatible_words->letter_mask[j] >> (w[j]-'a')) & 1)) {
+                    ok = false;
+                    break;
+                }
+            }
+            if (!ok) continue;
+        }
+        cand.push_back(i);
+    }
+}
+
+// find distinct unused words for the slots of the given length
+// that need them: filled slots with unchecked cells,
+// 'extra' (such a slot whose current word we're considering;
+// on the filled stack if we backtracked to it) if given,
+// and with --matching, unfilled slots.
+// If 'assign', put the words in the (filled) slots.
+// Return false if there's no way to do this
+//
+bool GRID::match_words(int len, SLOT *extra, bool assign) {
+    vector<SLOT*> ms;
+    int nused = 0;
+    for (SLOT *s: filled_slots) {
+        if (s->len != len || s == extra) continue;
+        if (s->free_mask) {
+            ms.push_back(s);
+            continue;
+        }
+        nused++;
+    }
+    if (do_matching) {
+        for (SLOT *s: slots) {
+            if (s->len != len || s->filled || s == extra) continue;
+            ms.push_back(s);
+        }
+    }
+    if (extra) ms.push_back(extra);
+    if (ms.empty()) return true;
+
+    // leave out unfilled slots that can't fail to get a word
+    //
+    size_t big = (ms.size() + nused) * words.max_copies[len];
+    size_t n = 0;
+    for (SLOT *s: ms) {
+        if (!s->filled && s != extra && s->compatible_words->size() >= big) {
+            continue;
+        }
+        ms[n++] = s;
+    }
+    ms.resize(n);
+    if (ms.empty()) return true;
 
-        // update compatible word lists of crossing slots.
-        // push_next_slot() assumes that these are up to date
+    WORD_MATCHING m;
+    m.cand.resize(ms.size());
+    m.match.assign(ms.size(), -1);
+    for (unsigned int j=0; j<ms.size(); j++) {
+        SLOT *s = ms[j];
+        if (s == extra) {
+            // match it as if filled with its current word.
+            // When backtracking it's still on the filled stack
+            //
+            bool was_filled = s->filled;
+            s->filled = true;
+            s->matching_candidates(m.cand[j]);
+            s->filled = was_filled;
+        } else {
+            s->matching_candidates(m.cand[j]);
+        }
+        // start from the previous matching
         //
-        slot2->compatible_words = pattern_cache[slot2->len].get_matches(
-            slot2->filled_pattern
-        );
-        if (slot2->compatible_words->empty()) {
-            // should never get here
-            printf("   empty compat list for slot %d pattern %s\n",
-                slot2->num, slot2->filled_pattern
+        int w = s->match_word;
+        if (w < 0 || m.owner.count(w)) continue;
+        for (int i: m.cand[j]) {
+            if (i == w) {
+                m.owner[w] = j;
+                m.match[j] = w;
+                break;
+            }
+        }
+    }
+    for (unsigned int j=0; j<ms.size(); j++) {
+        if (m.match[j] >= 0) continue;
+        m.visited.clear();
+        if (!m.augment(j)) {
+            if (verbose) {
+                printf("no distinct words for slots of length %d\n", len);
+            }
+            return false;
+        }
+    }
+    for (unsigned int j=0; j<ms.size(); j++) {
+        ms[j]->match_word = m.match[j];
+        if (assign) {
+            strcpy(ms[j]->current_word, words.words[len][m.match[j]]);
+        }
+    }
+    return true;
+}
+
+// --matching: after installing a word in the given slot,
+// check the lengths whose slots may have changed
+//
+bool GRID::check_matching(SLOT *slot) {
+    if (do_propagate) {
+        // lists may have changed anywhere
+        for (int len=1; len<=MAX_LEN; len++) {
+            if (!match_words(len, NULL, false)) return false;
+        }
+        return true;
+    }
+    bool checked[MAX_LEN+1];
+    memset(checked, 0, sizeof(checked));
+    checked[slot->len] = true;
+    if (!match_words(slot->len, NULL, false)) return false;
+    for (int i=0; i<slot->len; i++) {
+        LINK &link = slot->links[i];
+        if (link.empty()) continue;
+        int len2 = link.other_slot->len;
+        if (checked[len2]) continue;
+        checked[len2] = true;
+        if (!match_words(len2, NULL, false)) return false;
+    }
+    return true;
+}
+
+// pick words for the slots with unchecked cells.
+// Return false if there's no way to do this without duplicates
+//
+bool GRID::expand_mwords() {
+    if (!use_mwords || allow_dups) return true;
+        // with dups, each slot's current word will do
+    for (int len=1; len<=MAX_LEN; len++) {
+        if (!match_words(len, NULL, true)) return false;
+    }
+    return true;
+}
+
+///////////////// COUNTING
+//
+// With --count, once every unfilled slot is complete
+// (i.e. its crossings are all filled) the slots are independent,
+// except that they can't use the same word.
+// So instead of enumerating their fills, we count them,
+// and then backtrack as if after a solution.
+// The slot heap puts complete slots last,
+// so we reach such states as soon as possible.
+
+#define MAX_COUNT_GROUP 12
+    // the most complete slots of one length whose fills we count;
+    // the cost is exponential in this
+
+static bool count_mul(COUNT &a, COUNT b) {
+    return !__builtin_mul_overflow(a, b, &a);
+}
+
+static bool count_add(COUNT &a, COUNT b) {
+    return !__builtin_add_overflow(a, b, &a);
+}
+
+// the number of ways to fill the unfilled slots, all of which are complete.
+// Slots of different lengths can't share words, so we count
+// each length separately and multiply.
+// Within a length, words that are in only one slot's list
+// don't interact; for the others (the 'shared' words)
+// we count the ways to give them to distinct subsets of the slots:
+// ways[m] is the number of ways to fill the slots in the set m
+// with shared words.
+// Return false if a length has too many slots to count this way
+//
+bool GRID::count_completions(COUNT &n) {
+    vector<SLOT*> group[MAX_LEN+1];
+    vector<SLOT*> scope;
+    unfilled_scope(scope);
+    for (SLOT *s: scope) {
+        group[s->len].push_back(s);
+    }
+    for (int len=1; len<=MAX_LEN; len++) {
+        if ((int)group[len].size() > MAX_COUNT_GROUP) return false;
+    }
+    n = 1;
+    for (int len=1; len<=MAX_LEN; len++) {
+        vector<SLOT*> &g = group[len];
+        int k = g.size();
+        if (!k) continue;
+        vector<int> &canon = words.canon[len];
+        vector<int> &level = word_level[len];
+        vector<COUNT> nprivate(k, 0);
+        unordered_map<int, unsigned int> owners;
+            // word -> set of slots whose list it's in
+        for (int j=0; j<k; j++) {
+            for (int i: *g[j]->compatible_words) {
+                if (allow_dups) {
+                    nprivate[j]++;
+                } else if (canon[i] == i && level[i] < 0) {
+                    if (k == 1) {
+                        nprivate[j]++;
+                    } else {
+                        owners[i] |= 1 << j;
+                    }
+                }
+            }
+        }
+        vector<COUNT> ways(1<<k, 0);
+        ways[0] = 1;
+        for (auto &x: owners) {
+            unsigned int m = x.second;
+            if (!(m & (m-1))) {
+                nprivate[__builtin_ctz(m)]++;
+                continue;
+            }
+            for (int mask=(1<<k)-1; mask>=0; mask--) {
+                for (int j=0; j<k; j++) {
+                    if (!((m >> j) & 1) || !((mask >> j) & 1)) continue;
+                    if (!count_add(ways[mask], ways[mask ^ (1<<j)])) {
+                        count_overflow = true;
+                    }
+                }
+            }
+        }
+        COUNT total = 0;
+        for (int mask=0; mask<(1<<k); mask++) {
+            COUNT c = ways[mask];
+            if (!c) continue;
+            for (int j=0; j<k; j++) {
+                if (!((mask >> j) & 1) && !count_mul(c, nprivate[j])) {
+                    count_overflow = true;
+                }
+            }
+            if (!count_add(total, c)) count_overflow = true;
+        }
+        if (!count_mul(n, total)) count_overflow = true;
+    }
+    return true;
+}
+
+void GRID::add_count(COUNT n) {
+    ncount_nodes++;
+    if (!count_add(solution_count, n)) count_overflow = true;
+}
+
+const char* count_str(COUNT n) {
+    static char buf[64];
+    char *p = buf + sizeof(buf) - 1;
+    *p = 0;
+    do {
+        *--p = '0' + (int)(n % 10);
+        n /= 10;
+    } while (n);
+    return p;
+}
+
+///////////////// COMPONENTS
+//
+// With --components, before selecting a slot we check whether
+// the unfilled slots we're working on (all of them, or those of
+// the component being solved) form more than one component:
+// slots are connected if they cross at an unfilled cell.
+// If so, we push a frame and solve the components one at a time,
+// smallest first, with the floor of the filled stack
+// at the level where each one started.
+//
+// When a component has no more fills, the state where the split
+// was found has no solution, unless the component rejected a word
+// used by an earlier component.
+// In that case we backtrack into the earlier component as usual;
+// otherwise we pop the whole split.
+//
+// The result of solving a component depends only on its state
+// (its slots' patterns, and lists if propagating),
+// unless it rejected a word used outside it.
+// Such results are memoized: a component with no fill fails at once,
+// and the first fill of a solvable one is replayed.
+// Replayed slots keep their place in their lists,
+// so backtracking into them goes on as the search would have.
+//
+// With --count, each component's fills are counted separately
+// and the counts are multiplied.
+// That's exact only if the components can't share words,
+// so without --allow_dups we split only if their lengths differ.
+
+// the unfilled slots of the current component, or all of them
+//
+void GRID::unfilled_scope(vector<SLOT*> &v) {
+    v.clear();
+    if (comp_frames.empty()) {
+        v = slot_heap.heap;
+        return;
+    }
+    COMPONENT_FRAME &f = comp_frames.back();
+    for (SLOT *s: f.comps[f.cur]) {
+        if (!s->filled) v.push_back(s);
+    }
+}
+
+// the best unfilled slot of the current component, or NULL
+//
+SLOT* GRID::scope_top() {
+    if (comp_frames.empty()) return slot_heap.top();
+    COMPONENT_FRAME &f = comp_frames.back();
+    SLOT *best = NULL;
+    for (SLOT *s: f.comps[f.cur]) {
+        if (s->filled) continue;
+        if (!best || slot_heap.less(s, best)) best = s;
+    }
+    return best;
+}
+
+// hash of a component's state (FNV-1a, like SLOT::state_hash())
+//
+uint64_t GRID::component_hash(vector<SLOT*> &comp) {
+    uint64_t h = 14695981039346656037ULL;
+    const uint64_t prime = 1099511628211ULL;
+    for (SLOT *s: comp) {
+        h = (h ^ (uint64_t)(s->num + 256)) * prime;
+        for (int i=0; i<s->len; i++) {
+            h = (h ^ (unsigned char)s->filled_pattern[i]) * prime;
+        }
+        if (do_propagate && s->compatible_words->key) {
+            // the list may be smaller than the pattern's
+            for (char c: *s->compatible_words->key) {
+                h = (h ^ (unsigned char)c) * prime;
+            }
+        }
+    }
+    return h;
+}
+
+// if the unfilled slots in scope form more than one component,
+// push a frame and start the first one.
+// Return true if we did
+//
+bool GRID::split_components() {
+    vector<SLOT*> scope;
+    unfilled_scope(scope);
+    if (scope.size() < 2) return false;
+    vector<int> id(slots.size(), -2);
+    for (SLOT *s: scope) {
+        id[s->index] = -1;
+    }
+    int ncomps = 0;
+    vector<SLOT*> todo;
+    for (SLOT *s: slots) {
+        if (id[s->index] != -1) continue;
+        id[s->index] = ncomps;
+        todo.push_back(s);
+        while (!todo.empty()) {
+            SLOT *s1 = todo.back();
+            todo.pop_back();
+            for (int i=0; i<s1->len; i++) {
+                LINK &link = s1->links[i];
+                if (link.empty() || s1->filled_pattern[i] != '_') continue;
+                SLOT *s2 = link.other_slot;
+                if (id[s2->index] != -1) continue;
+                id[s2->index] = ncomps;
+                todo.push_back(s2);
+            }
+        }
+        ncomps++;
+    }
+    if (ncomps < 2) return false;
+    if (count_solutions && !allow_dups) {
+        int len_comp[MAX_LEN+1];
+        for (int i=0; i<=MAX_LEN; i++) len_comp[i] = -1;
+        for (SLOT *s: scope) {
+            int &c = len_comp[s->len];
+            if (c >= 0 && c != id[s->index]) return false;
+            c = id[s->index];
+        }
+    }
+    COMPONENT_FRAME f;
+    f.comps.resize(ncomps);
+    for (SLOT *s: slots) {
+        if (id[s->index] >= 0) f.comps[id[s->index]].push_back(s);
+    }
+    // smallest first (a small component is cheap to fill or refute);
+    // ties go to the most constrained
+    //
+    vector<pair<pair<size_t, size_t>, int> > order;
+    for (int i=0; i<ncomps; i++) {
+        size_t n = f.comps[i][0]->ncompatible();
+        for (SLOT *s: f.comps[i]) {
+            n = min(n, (size_t)s->ncompatible());
+        }
+        order.push_back(make_pair(make_pair(f.comps[i].size(), n), i));
+    }
+    for (int i=1; i<ncomps; i++) {
+        for (int j=i; j>0 && order[j] < order[j-1]; j--) {
+            swap(order[j], order[j-1]);
+        }
+    }
+    vector<vector<SLOT*> > comps(ncomps);
+    for (int i=0; i<ncomps; i++) {
+        comps[i].swap(f.comps[order[i].second]);
+    }
+    f.comps.swap(comps);
+    f.level = filled_slots.size();
+    f.outer_floor = floor_level;
+    f.cur = 0;
+    if (count_solutions) {
+        f.base = solution_count;
+        f.product = 1;
+        solution_count = 0;
+    }
+    if (verbose) {
+        printf("split into %d components at level %lu\n", ncomps, f.level);
+    }
+    ncomp_splits++;
+    comp_frames.push_back(f);
+    start_component(comp_frames.back());
+    return true;
+}
+
+void GRID::start_component(COMPONENT_FRAME &f) {
+    f.start = filled_slots.size();
+    floor_level = f.start;
+    f.coupled = false;
+    f.dup_outside = false;
+    f.key = component_hash(f.comps[f.cur]);
+    f.memo_hit = comp_memo.find(f.key) != comp_memo.end();
+    if (f.memo_hit) ncomp_memo_hits++;
+}
+
+// called before selecting a slot.
+// Move on to the next component if the current one is filled,
+// use memoized results, and look for a new split.
+// Return false if the search can't go on from here
+// (backtrack() will deal with it).
+// Return true, with no slot to select, if the grid is full
+//
+bool GRID::next_component() {
+    while (1) {
+        if (comp_frames.empty()) {
+            if (filled_slots.size() + npreset_slots == slots.size()) {
+                return true;
+            }
+            if (!split_components()) return true;
+            continue;
+        }
+        COMPONENT_FRAME &f = comp_frames.back();
+        if (f.memo_hit) {
+            f.memo_hit = false;
+            COMPONENT_MEMO &m = comp_memo[f.key];
+            if (count_solutions) {
+                // component_exhausted() will use this
+                solution_count = m.count;
+                return false;
+            }
+            if (!m.solved) return false;
+            if (verbose) {
+                printf("replaying component %d of %lu\n",
+                    f.cur, f.comps.size()
+                );
+            }
+            if (!replay_component(m)) return false;
+            continue;
+        }
+        bool done = true;
+        for (SLOT *s: f.comps[f.cur]) {
+            if (!s->filled) {
+                done = false;
+                break;
+            }
+        }
+        if (!done) {
+            if (!split_components()) return true;
+            continue;
+        }
+        if (count_solutions) {
+            // a fill of the component; count it and backtrack
+            add_count(1);
+            if (do_cbj && !filled_slots.empty()) {
+                SLOT *top = filled_slots.back();
+                top->conflicts.add_below(top->stack_level);
+            }
+            return false;
+        }
+        if (!f.dup_outside && !do_lcv) {
+            if (comp_memo.size() >= MAX_COMPONENT_MEMO) comp_memo.clear();
+            COMPONENT_MEMO &m = comp_memo[f.key];
+            m.solved = true;
+            m.steps.clear();
+            for (size_t i=f.start; i<filled_slots.size(); i++) {
+                SLOT *s = filled_slots[i];
+                if (s->trail_level < 0) continue;
+                    // filled by its crossings; the replay will do this
+                COMPONENT_STEP st;
+                st.slot = s;
+                st.word_index = s->word_index;
+                st.next_word_index = s->next_word_index;
+                m.steps.push_back(st);
+            }
+        }
+        if (++f.cur < f.comps.size()) {
+            start_component(f);
+            continue;
+        }
+        floor_level = f.outer_floor;
+        comp_frames.pop_back();
+    }
+}
+
+// push the words of a memoized fill of the current component.
+// If a word has been used since, stop; the search fills the rest.
+// Return false if installing a word fails
+// (e.g. a nogood); backtrack() will try the slot's next word
+//
+bool GRID::replay_component(COMPONENT_MEMO &m) {
+    for (COMPONENT_STEP &st: m.steps) {
+        SLOT *s = st.slot;
+        if (!allow_dups && word_level[s->len][st.word_index] >= 0) {
+            return true;
+        }
+        strcpy(s->current_word, words.words[s->len][st.word_index]);
+        s->word_index = st.word_index;
+        s->next_word_index = st.next_word_index;
+        s->dup_stack_level = -1;
+        if (do_cbj) {
+            // we don't know what rejected the words before it
+            s->conflicts.clear();
+            s->conflicts.add_below(filled_slots.size());
+        }
+        if (!push_slot(s)) return false;
+    }
+    return true;
+}
+
+// the current component has no more fills;
+// the filled stack is at the level where it started.
+// Return true if the search can go on from here
+// (with --count, in the next component)
+//
+bool GRID::component_exhausted() {
+    COMPONENT_FRAME &f = comp_frames.back();
+    if (count_solutions) {
+        COUNT c = solution_count;
+        if (allow_dups) {
+            // otherwise the count depends on the words used outside
+            if (comp_memo.size() >= MAX_COMPONENT_MEMO) comp_memo.clear();
+            COMPONENT_MEMO &m = comp_memo[f.key];
+            m.solved = c > 0;
+            m.count = c;
+        }
+        if (!count_mul(f.product, c)) count_overflow = true;
+        solution_count = 0;
+        if (c && ++f.cur < f.comps.size()) {
+            start_component(f);
+            return true;
+        }
+        solution_count = f.base;
+        if (c && !count_add(solution_count, f.product)) {
+            count_overflow = true;
+        }
+        floor_level = f.outer_floor;
+        comp_frames.pop_back();
+    } else {
+        if (!f.dup_outside) {
+            if (comp_memo.size() >= MAX_COMPONENT_MEMO) comp_memo.clear();
+            COMPONENT_MEMO &m = comp_memo[f.key];
+            m.solved = false;
+            m.steps.clear();
+        }
+        bool coupled = f.coupled;
+        size_t level = f.level;
+        if (verbose) {
+            printf("component %d of %lu failed%s\n",
+                f.cur, f.comps.size(), coupled?" (coupled)":""
             );
-            exit(1);
         }
+        floor_level = f.outer_floor;
+        comp_frames.pop_back();
+        if (!coupled) {
+            // no fill of the other components can help
+            while (filled_slots.size() > level) {
+                pop_slot();
+            }
+        }
+    }
+    if (do_cbj && !filled_slots.empty()) {
+        SLOT *top = filled_slots.back();
+        top->conflicts.add_below(top->stack_level);
+    }
+    return false;
+}
+
+// a word used at the given stack level was rejected (-1: some word).
+// Record this in the frames it affects
+//
+void GRID::note_dup(int level) {
+    for (COMPONENT_FRAME &f: comp_frames) {
+        if (level < (int)f.start) {
+            f.dup_outside = true;
+            if (level < 0 || level >= (int)f.level) f.coupled = true;
+        }
+    }
+}
+
+// forget the splits, e.g. to go on after a solution
+//
+void GRID::clear_components() {
+    if (comp_frames.empty()) return;
+    floor_level = comp_frames[0].outer_floor;
+    comp_frames.clear();
+}
+
+///////////////// PROPAGATION
+//
+// With --propagate, the lists of unfilled slots are kept arc consistent:
+// for each crossing of unfilled slots S and T,
+// every letter in S's list at the crossing is also in T's list.
+// Letter masks make the test cheap; when it fails,
+// we reduce T's list to the words whose letter is in S's mask,
+// and queue T to check its own crossings.
+// Reduced lists are in the pattern cache (see get_matches_restrict()).
+// Every list change is recorded on the trail,
+// and undone when the word that caused it is uninstalled.
+// A slot whose list has one word is selected next by select_slot(),
+// so singletons are filled without branching.
+
+// change a slot's list, recording the old one on the trail.
+// If pos >= 0, the change is due to a letter just put in that position
+// of the slot's pattern; undoing the change clears it
+//
+void GRID::set_list_trail(SLOT *slot, ILIST *ilist, int pos) {
+    TRAIL_ENTRY e;
+    e.slot = slot;
+    e.pos = pos;
+    e.list = slot->compatible_words;
+    if (e.list) pin_list(e.list);
+    trail.push_back(e);
+    slot->set_compatible_words(ilist);
+}
+
+// restore lists changed since the trail had the given size
+//
+void GRID::undo_trail(size_t level) {
+    while (trail.size() > level) {
+        TRAIL_ENTRY &e = trail.back();
+        if (e.pos >= 0) {
+            e.slot->filled_pattern[e.pos] = '_';
+            e.slot->nopen++;
+        }
+        e.slot->set_compatible_words(e.list);
+        if (e.list) unpin_list(e.list);
+        trail.pop_back();
+    }
+}
+
+// forget the trail, e.g. before the lists are reset
+//
+void GRID::clear_trail() {
+    for (TRAIL_ENTRY &e: trail) {
+        if (e.list) unpin_list(e.list);
+    }
+    trail.clear();
+    for (SLOT *s: prop_queue) {
+        s->in_queue = false;
+    }
+    prop_queue.clear();
+}
+
+// propagate the changes to the lists of queued slots.
+// Return false if a list becomes empty
+//
+bool GRID::propagate() {
+    bool ok = true;
+    while (ok && !prop_queue.empty()) {
+        SLOT *slot = prop_queue.back();
+        prop_queue.pop_back();
+        slot->in_queue = false;
+        if (slot->filled) continue;
+        ILIST *list = slot->compatible_words;
+        for (int i=0; i<slot->len; i++) {
+            LINK &link = slot->links[i];
+            if (link.empty()) continue;
+            SLOT *slot2 = link.other_slot;
+            if (slot2->filled) continue;
+            int pos2 = link.other_pos;
+            unsigned int mask = list->letter_mask[i];
+            if (!(slot2->compatible_words->letter_mask[pos2] & ~mask)) {
+                continue;
+            }
+            set_list_trail(slot2,
+                pattern_cache(slot2->len).get_matches_restrict(
+                    slot2->compatible_words, pos2, mask
+                )
+            );
+            if (verbose_propagate) {
+                printf("propagate: slot %s reduced to %d words\n",
+                    slot2->name, (int)slot2->compatible_words->size()
+                );
+            }
+            if (slot2->compatible_words->empty()) {
+                if (verbose_propagate) {
+                    printf("propagate: slot %s has no words\n", slot2->name);
+                }
+                ok = false;
+                break;
+            }
+            enqueue(slot2);
+        }
+    }
+    for (SLOT *s: prop_queue) {
+        s->in_queue = false;
+    }
+    prop_queue.clear();
+    return ok;
+}
+
+// We just popped this slot S from the stack.
+// Find the level of the topmost filled slot that affects it, i.e.
+// - had a dup word conflict
+// - intersects S
+// - intersects an unfilled slot that intersects S
+//
+// This is used for "backjumping": if we couldn't find a word for this slot,
+// we want to backtrack all the way to a slot that will make a difference
+//
+int SLOT::top_affecting_level() {
+    int max_level=-1;
+    if (dup_stack_level >= 0) {
+        max_level = dup_stack_level;
+        if (max_level == stack_level-1) return max_level;
+    }
+    for (int i=0; i<len; i++) {
+        LINK &link = links[i];
+        if (link.empty()) continue;
+        SLOT* slot2 = link.other_slot;
+        if (slot2->filled) {
+            if (slot2->stack_level > max_level) {
+                max_level = slot2->stack_level;
+                if (max_level == stack_level-1) return max_level;
+            }
+        } else {
+            for (int j=0; j<slot2->len; j++) {
+                LINK &link2 = slot2->links[j];
+                if (link2.empty()) continue;
+                SLOT* slot3 = link2.other_slot;
+                if (slot3->filled) {
+                    if (slot3->stack_level > max_level) {
+                        max_level = slot3->stack_level;
+                        if (max_level == stack_level-1) return max_level;
+                    }
+                }
+            }
+        }
+    }
+    return max_level;
+}
+
+// Remove a filled word.
+// Update filled_patterns of unfilled crossing slots
+//
+void SLOT::uninstall_word() {
+    if (verbose) {
+        printf("uninstalling %s from slot %s\n", current_word, name);
+    }
+    grid->unuse_word(this);
+
+    // restore the patterns and lists of crossing slots,
+    // and undo any pruning and propagation since the word was installed.
+    // A slot filled implicitly changed nothing
+    //
+    if (trail_level >= 0) {
+        grid->undo_trail(trail_level);
     }
 }
 
@@ -594,10 +1722,22 @@ void SLOT::uninstall_word() {
 // and update compat word lists for crossing slots
 // Look for next usable word for S.
 // if find one: add it, update crossing slots, and return true
-// else pop S and repeat for next slot down on stack
+// else pop S and repeat for next slot down on stack.
+// Return false if we pop down to floor_level
 //
 bool GRID::backtrack() {
     while (1) {
+        if (backtrack_stack()) return true;
+        if (comp_frames.empty()) return false;
+        if (component_exhausted()) return true;
+    }
+}
+
+bool GRID::backtrack_stack() {
+    while (1) {
+        if (filled_slots.size() <= floor_level) {
+            return false;
+        }
         SLOT *slot = filled_slots.back();
         if (verbose) {
             printf("backtracking to slot %d\n", slot->num);
@@ -619,9 +1759,12 @@ bool GRID::backtrack() {
             }
         }
 
-        if (slot->find_next_usable_word(this)) {
-            install_word(slot);
-            return true;
+        if (slot->find_next_usable_word()) {
+            if (install_word(slot)) {
+                return true;
+            }
+            // propagation failed; undo and try the next word
+            continue;
         }
 
         if (verbose) {
@@ -630,227 +1773,155 @@ bool GRID::backtrack() {
 pop:
         filled_slots.pop_back();
         slot->filled = false;
-        if (filled_slots.empty()) {
+        slot_heap.insert(slot);
+        if (filled_slots.size() <= floor_level) {
             return false;
         }
+        if (do_cbj) {
+            if (!conflict_jump(slot, slot->stack_level)) {
+                while (filled_slots.size() > floor_level) {
+                    pop_slot();
+                }
+                return false;
+            }
+            continue;
+        }
         if (do_backjump) {
             int level = slot->top_affecting_level();
             if (verbose) {
                 printf("backjumping to level %d\n", level);
             }
+            if (level < (int)floor_level) {
+                // nothing above the floor can fix this
+                return false;
+            }
             while (filled_slots.size() > level+1) {
-                slot = filled_slots.back();
-                slot->uninstall_word();
-                slot->filled = false;
-                filled_slots.pop_back();
                 if (verbose) {
-                    printf("popping slot %s: backjump\n", slot->name);
+                    printf("popping slot %s: backjump\n",
+                        filled_slots.back()->name
+                    );
                 }
+                pop_slot();
             }
         }
     }
 }
 
-// returns from get_commands()
-#define CONT    1
-#define RESTART 2
-#define EXIT    3
-
-int GRID::get_commands() {
-    int retval = CONT;
-    while (1) {
-        printf("enter command\n"
-            "s: append solution to file (default 'solutions')\n"
-            "<CR>: next solution\n"
-            "v word: add word to veto list\n> "
-            "r: restart with new random word order\n> "
-            "q: quit\n> "
+// Conflict-directed backjumping.
+// The given slot, which would be at the given level of the stack,
+// has no more usable words; the stack has been popped to that level.
+// Its conflict set, plus the filled slots crossing it,
+// are the levels whose words caused the rejections.
+// Pop down to the highest of them, H,
+// and add the conflict set to H's: if H runs out of words,
+// these levels are also to blame.
+// Return false if there's no such level above the floor
+//
+bool GRID::conflict_jump(SLOT *slot, int level) {
+    CONFLICT_SET &c = slot->conflicts;
+    slot->add_crossing_conflicts(c);
+    int h = c.max_below(level);
+    if (verbose) {
+        printf("slot %s: conflict jump from level %d to %d\n",
+            slot->name, level, h
         );
-        char buf[256];
-        fgets(buf, sizeof(buf), stdin);
-        int len = strlen(buf);
-        if (len == 1) {
-            return retval;
-        }
-        buf[len-1] = 0;
-        if (!strcmp(buf, "r")) {
-            return RESTART;
-        } else if (!strcmp(buf, "q")) {
-            return EXIT;
-        } else if (!strcmp(buf, "s")) {
-            print_grid(*this, false, solution_file);
-            fflush(solution_file);
-        } else if (strstr(buf, "v ")==buf) {
-            FILE *f = fopen(veto_fname, "a");
-            fprintf(f, "%s\n", buf+2);
-            fclose(f);
-            words.read_veto_file(veto_fname);
-            words.read(word_list, reverse_words);
-            retval = RESTART;
-        } else {
-            printf("bad command %s\n", buf);
-        }
     }
-}
-
-bool GRID::find_solutions() {
-    double start_cpu_time = get_cpu_time();
-    if (verbose) {
-        print_state();
+    if (h < (int)floor_level) {
+        return false;
     }
-    while (1) {
-        if (filled_slots.size() + npreset_slots == slots.size()) {
-            // we have a solution
-            if (curses) {
-                clear();
-                refresh();
-                endwin();
-            }
-            double now = get_cpu_time();
-            double etime = now - start_cpu_time;
-            if (perf) {
-                print_perf_json(nsteps, now);
-                exit(0);
-            }
-            printf("\nSolution found:\n");
-            print_grid(*this, false, stdout);
-            printf("CPU time: %f\n", get_cpu_time() - start_cpu_time);
-            printf("Steps: %d\n", nsteps);
-            if (verbose) {
-                exit(0);
-            }
-            switch (get_commands()) {
-            case CONT:
-                backtrack();
-                break;
-            case RESTART:
-                restart();
-                nsteps = 0;
-                start_cpu_time = now;
-                break;
-            case EXIT:
-                exit(0);
-            }
-            if (curses) {
-                initscr();
-            }
-            continue;
-        }
-        if (!push_next_slot()) {
-            if (!backtrack()) {
-                break;
-            }
-        }
-        if (!(nsteps % step_period)) {
-            if (max_time) {
-                double et = get_cpu_time() - start_cpu_time;
-                if (et > max_time) {
-                    if (perf) {
-                        print_fail_json();
-                    } else {
-                        printf("max CPU time exceeded\n");
-                    }
-                    exit(0);
-                }
-            }
-            if (!verbose && !perf) {
-                print_grid(*this, curses, stdout);
-            }
+    while ((int)filled_slots.size() > h+1) {
+        if (verbose) {
+            printf("popping slot %s: conflict jump\n",
+                filled_slots.back()->name
+            );
         }
+        pop_slot();
     }
-    printf("no more solutions\n");
+    filled_slots[h]->conflicts.merge(c);
+    return true;
+}
+
+// the Luby sequence 1 1 2 1 1 2 4 1 1 2 1 1 2 4 8 ...; i >= 1
+//
+int luby(int i) {
+    int k = 1;
+    while ((1<<k) - 1 < i) k++;
+    if (i == (1<<k) - 1) return 1<<(k-1);
+    return luby(i - (1<<(k-1)) + 1);
 }
 
-void GRID::restart() {
+// start the search over, with the words in a new order
+// (shuffled with the given seed)
+//
+void GRID::restart(unsigned int seed) {
+    clear_trail();
+    clear_components();
+    comp_memo.clear();
+        // replayed fills depend on the word order
     for (SLOT* slot: slots) {
         strcpy(slot->filled_pattern, slot->preset_pattern);
+        slot->set_compatible_words(NULL);
+    }
+    cache.order.shuffle(seed);
+    if (maximize_score) {
+        cache.order.sort_by_score();
     }
-    words.shuffle();
-    init_pattern_cache();
+    cache.init();
     filled_slots.clear();
     prepare_grid();
 }
 
-int main(int argc, char** argv) {
-    GRID grid;
-    bool show_grid = false;
-    bool help = false;
-
-    for (int i=1; i<argc; i++) {
-        if (!strcmp(argv[i], "--allow_dups")) {
-            allow_dups = true;
-        } else if (!strcmp(argv[i], "--backjump")) {
-            do_backjump = true;
-        } else if (!strcmp(argv[i], "--curses")) {
-            curses = true;
-        } else if (!strcmp(argv[i], "--grid_file")) {
-            grid_file = argv[++i];
-        } else if (!strcmp(argv[i], "--help")) {
-            help = true;
-        } else if (!strcmp(argv[i], "--max_time")) {
-            max_time = atof(argv[++i]);
-        } else if (!strcmp(argv[i], "--perf")) {
-            perf = true;
-        } else if (!strcmp(argv[i], "--prune")) {
-            do_prune = true;
-        } else if (!strcmp(argv[i], "--reverse")) {
-            reverse_words = true;
-        } else if (!strcmp(argv[i], "--show_grid")) {
-            show_grid = true;
-        } else if (!strcmp(argv[i], "--shuffle")) {
-            shuffle = true;
-        } else if (!strcmp(argv[i], "--solution_file")) {
-            solution_fname = argv[++i];
-        } else if (!strcmp(argv[i], "--step_period")) {
-            step_period = atoi(argv[++i]);
-        } else if (!strcmp(argv[i], "--verbose")) {
-            verbose = true;
-        } else if (!strcmp(argv[i], "--verbose_slot")) {
-            verbose_slot = true;
-        } else if (!strcmp(argv[i], "--verbose_word")) {
-            verbose_word = true;
-        } else if (!strcmp(argv[i], "--verbose_prune")) {
-            verbose_prune = true;
-        } else if (!strcmp(argv[i], "--veto_file")) {
-            veto_fname = argv[++i];
-        } else if (!strcmp(argv[i], "--word_list")) {
-            word_list = argv[++i];
-        } else {
-            fprintf(stderr, "unknown option '%s'\n", argv[i]);
-            exit(1);
-        }
-    }
-    if (help) {
-        printf("%s", options);
-        exit(0);
-    }
-    solution_file = fopen(solution_fname, "wa");
-    words.read_veto_file(veto_fname);
-    words.read(word_list, reverse_words);
-    if (shuffle) {
-        std::srand(time(0)+getpid());
-        words.shuffle();
-    }
-    init_pattern_cache();
-    if (grid_file) {
-        char buf[256];
-        sprintf(buf, "../grids/%s", grid_file);
-        grid_file = buf;
-    }
-    make_grid(grid_file, grid);
-    grid.prepare_grid();
-    if (show_grid) {
-        grid.print_state(true);
-        exit(0);
-    }
-    if (verbose) {
-        print_params();
-    }
-    if (curses) {
-        initscr();
+// the algorithm variant, for --perf output and portfolio reports
+//
+const char* GRID::variant_name() {
+    if (do_prune && do_backjump) return "prune+backjump";
+    if (do_prune) return "prune";
+    if (do_backjump) return "backjump";
+    if (do_propagate && do_cbj) return "propagate+cbj";
+    if (do_propagate) return "propagate";
+    if (do_cbj) return "cbj";
+    return "default";
+}
+
+// make a copy of the grid's slots, links, and options,
+// e.g. for a concurrent search.
+// The copy has its own (empty) pattern cache, with the same word order;
+// call prepare_grid() on it.
+//
+GRID* GRID::clone() {
+    GRID *g = new GRID;
+    g->do_prune = do_prune;
+    g->do_backjump = do_backjump;
+    g->allow_dups = allow_dups;
+    g->do_propagate = do_propagate;
+    g->do_cbj = do_cbj;
+    g->do_nogoods = do_nogoods;
+    g->do_lcv = do_lcv;
+    g->maximize_score = maximize_score;
+    g->use_mwords = use_mwords;
+    g->do_matching = do_matching;
+    g->grid_printer = grid_printer;
+    g->nogoods.max_entries = nogoods.max_entries;
+    g->cache.order = cache.order;
+    g->cache.budget.max_bytes = cache.budget.max_bytes;
+    for (SLOT *s: slots) {
+        SLOT *s2 = new SLOT(s->len);
+        s2->num = s->num;
+        s2->row = s->row;
+        s2->col = s->col;
+        s2->is_across = s->is_across;
+        strcpy(s2->preset_pattern, s->preset_pattern);
+        g->add_slot(s2);
     }
-    grid.find_solutions();
-    if (curses) {
-        endwin();
+    for (unsigned int i=0; i<slots.size(); i++) {
+        SLOT *s = slots[i];
+        for (int j=0; j<s->len; j++) {
+            LINK &link = s->links[j];
+            if (link.empty()) continue;
+            int k = 0;
+            while (slots[k] != link.other_slot) k++;
+            g->slots[i]->add_link(j, g->slots[k], link.other_pos);
+        }
     }
+    return g;
 }
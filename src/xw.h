@@ -5,14 +5,32 @@
 #include <vector>
 #include <unordered_set>
 #include <stack>
+#include <deque>
+#include <queue>
 #include <cstdlib>
+#include <atomic>
 #include <ncurses.h>
 
 #include "words.h"
 
 using namespace std;
 
+// debugging options and utilities from xw.cpp
+//
+extern bool verbose;
+extern bool verbose_word;
+extern bool verbose_slot;
 extern bool verbose_prune;
+extern bool verbose_propagate;
+extern double get_cpu_time();
+extern double get_thread_cpu_time();
+extern int luby(int i);
+
+// command-line options from xw_main.cpp, used by parallel.cpp
+//
+extern bool perf;
+extern double max_time;
+extern int step_period;
 
 #define CHECK_ASSERTS           0
     // do sanity checks: conditions that should always hold
@@ -36,11 +54,87 @@ struct LINK {
     }
 };
 
-static int slot_num = 0;
+extern atomic<int> slot_num;
+    // numbers the SLOTs of all grids (xw.cpp)
+
+// a set of levels of the filled stack, for conflict-directed backjumping
+//
+struct CONFLICT_SET {
+    vector<uint64_t> bits;
+
+    void init(int nlevels) {
+        bits.assign((nlevels+63)/64, 0);
+    }
+    void clear() {
+        for (uint64_t &b: bits) b = 0;
+    }
+    inline void add(int level) {
+        bits[level/64] |= (uint64_t)1 << (level%64);
+    }
+    // add levels 0..level-1
+    //
+    void add_below(int level) {
+        for (int i=0; i<level/64; i++) bits[i] = ~(uint64_t)0;
+        if (level%64) bits[level/64] |= ((uint64_t)1 << (level%64)) - 1;
+    }
+    void merge(CONFLICT_SET &c) {
+        for (unsigned int i=0; i<bits.size(); i++) bits[i] |= c.bits[i];
+    }
+    // the largest level less than the given one, or -1
+    //
+    int max_below(int level) {
+        for (int i=(level-1)/64; i>=0 && level>0; i--) {
+            uint64_t b = bits[i];
+            if (i == level/64) b &= ((uint64_t)1 << (level%64)) - 1;
+            if (b) return i*64 + 63 - __builtin_clzll(b);
+        }
+        return -1;
+    }
+};
+
+// with --lcv, a slot's words are tried in order of decreasing score
+// (ties: list order)
+//
+struct LCV_ENTRY {
+    double score;
+    int pos;    // position in the slot's list
+};
+
+struct LCV_LESS {
+    bool operator()(const LCV_ENTRY &a, const LCV_ENTRY &b) const {
+        if (a.score != b.score) return a.score < b.score;
+        return a.pos > b.pos;
+    }
+};
 
 struct SLOT {
     int num;        // number in grid (unique, but otherwise arbitrary)
     int len;
+    GRID *grid;     // set by GRID::add_slot()
+    int index;      // position in grid->slots
+    int heap_pos;   // position in grid->slot_heap, or -1
+    int trail_level;
+        // if filled by push: the size of the trail
+        // before this slot's word was installed; else -1
+    bool in_queue;
+        // in the propagation queue
+    unsigned int free_mask;
+        // with --mwords: the positions (bit i = position i)
+        // that are unchecked and not preset.
+        // If nonzero, the slot's lists are mword lists,
+        // its word isn't checked for duplicates during the search,
+        // and the word shown is picked when a solution is found
+        // (see GRID::expand_mwords())
+    int match_word;
+        // with --matching or --mwords: the slot's word in the last
+        // matching of slots to distinct words, or -1
+    int nopen;
+        // number of crossed positions not yet filled.
+        // If zero, the slot is 'complete': its words don't affect
+        // other slots (except for duplicates)
+    CONFLICT_SET conflicts;
+        // if --cbj: the stack levels of the filled slots that caused
+        // words to be rejected since the slot started scanning its list
     LINK links[MAX_LEN];    // crossing slots
 
     bool filled;
@@ -50,17 +144,23 @@ struct SLOT {
     char filled_pattern[MAX_LEN];
         // letters from crossing filled slots lower on stack
     ILIST *compatible_words;
-        // words compatible with filled pattern
+        // words compatible with filled pattern.
+        // Set this with set_compatible_words(); it's pinned in the cache
     int next_word_index;
         // if filled, next compatible word to try
+        // (with --lcv, the number of words tried)
+    priority_queue<LCV_ENTRY, vector<LCV_ENTRY>, LCV_LESS> lcv_queue;
+        // if --lcv: the words not yet tried; see lcv_order()
     char current_word[MAX_LEN];
         // if filled, current word
     string prune_signature;
     int stack_level;
         // if filled, the level on the filled stack
+    int word_index;
+        // if filled (and not preset), canonical index of current word
     int dup_stack_level;
         // if we skipped a compatible word because it was already used,
-        // the stack level of the slot that used it.
+        // the stack level of the slot that used it; else -1
     bool ref_by_higher[MAX_LEN];
         // if we backtrack to here, was this cell part of
         // any of the higher-level slots that we pushed?
@@ -71,19 +171,27 @@ struct SLOT {
     char name[16];
         // e.g. A(2,0)
 
-    // for each position and each letter (a-z)
-    // keep track of whether putting the letter in that position
-    // was OK (nonzero compatible words in the linked slot).
-    // These must be cleared each time we fill this slot.
-    //
-    bool usable_letter_checked[MAX_LEN][26];
-    bool usable_letter_ok[MAX_LEN][26];
+    unsigned int prune_letters_checked[MAX_LEN];
+        // if pruning: for each position, bitmask of the letters
+        // checked against the crossing slot since we started
+        // scanning compatible words.
+        // The first check of a letter marks the filled crossings
+        // of the crossing slot as ref_by_higher
 
     // create SLOT; you may increase len later
     SLOT(int _len=0) {
         len = _len;
         num = slot_num++;
+        grid = NULL;
+        index = 0;
+        heap_pos = -1;
+        trail_level = -1;
+        in_queue = false;
+        dup_stack_level = -1;
+        free_mask = 0;
+        match_word = -1;
         strcpy(preset_pattern, NULL_PATTERN);
+        compatible_words = NULL;
     }
     void add_link(int this_pos, SLOT* other_slot, int other_pos);
 
@@ -96,20 +204,212 @@ struct SLOT {
 
     void prepare_slot();
 
-    inline void clear_usable_letter_checked() {
-        memset(usable_letter_checked, 0, sizeof(usable_letter_checked));
+    inline void set_compatible_words(ILIST *ilist);
+    inline size_t ncompatible() {
+        return compatible_words?compatible_words->size():0;
     }
 
     void print_usable();
     void print_state(bool show_links);
-    bool find_next_usable_word(GRID*);
-    bool letter_compatible(int pos, char c);
+    bool find_next_usable_word();
+    void lcv_order();
+    int lcv_next();
+    // can the given letter go in the given crossed position?
+    // i.e. does the crossing slot (if unfilled) have a compatible word
+    // with that letter in the crossing position.
+    // The letter masks of the compatible list are updated
+    // whenever the list changes (install_word(), uninstall_word())
+    //
+    inline bool letter_compatible(int pos, char c) {
+        LINK &link = links[pos];
+        SLOT* slot2 = link.other_slot;
+        if (slot2->filled) return true;
+        return slot2->compatible_words->has_letter(link.other_pos, c);
+    }
+    void mark_crossings_ref_by_higher();
+    void add_crossing_conflicts(CONFLICT_SET&);
+    void matching_candidates(vector<int>&);
+    void add_nogood_conflicts(CONFLICT_SET&);
+    uint64_t state_hash();
+    int find_word_index();
     bool check_pattern(char* mp);
     void uninstall_word();
     int top_affecting_level();
     bool prune();
 };
 
+// solution counts (--count) can be large
+//
+typedef unsigned __int128 COUNT;
+extern const char* count_str(COUNT);
+    // in decimal, in a static buffer
+
+// The unfilled slots, in a binary heap ordered by
+// number of compatible words (ties: position in GRID::slots),
+// so the most constrained slot is on top.
+// Slots know their heap position, so when a slot's list changes
+// it can be moved up or down in O(log n)
+//
+struct SLOT_HEAP {
+    vector<SLOT*> heap;
+    bool defer_complete;
+        // with --count: complete slots go below the others
+
+    SLOT_HEAP() {
+        defer_complete = false;
+    }
+    inline bool less(SLOT *a, SLOT *b) {
+        if (defer_complete && (a->nopen == 0) != (b->nopen == 0)) {
+            return a->nopen != 0;
+        }
+        size_t na = a->ncompatible(), nb = b->ncompatible();
+        if (na != nb) return na < nb;
+        return a->index < b->index;
+    }
+    inline SLOT* top() {
+        return heap.empty()?NULL:heap[0];
+    }
+    void clear();
+    void insert(SLOT*);
+    void remove(SLOT*);
+    void update(SLOT*);
+    void sift_up(int);
+    void sift_down(int);
+    void set(int pos, SLOT *slot) {
+        heap[pos] = slot;
+        slot->heap_pos = pos;
+    }
+};
+
+// Nogoods: states of an unfilled slot in which it has no usable word.
+// Without pruning, propagation, or duplicate words,
+// whether a slot has a usable word depends only on its pattern
+// and the patterns of the unfilled slots crossing it;
+// a nogood is a hash of these (see SLOT::state_hash()).
+// When a slot has no usable words, we record its state;
+// after installing a word, we check the states of the crossing slots.
+// Nogoods don't depend on the word order, or on which words were vetoed
+// since they were found, so they're kept across restarts.
+// The oldest are dropped when the store is full.
+//
+struct NOGOOD_STORE {
+    size_t max_entries;
+    unordered_set<uint64_t> set;
+    deque<uint64_t> fifo;
+        // oldest first
+    long nlookups, nhits, nstores, nevictions;
+
+    NOGOOD_STORE() {
+        max_entries = 0;
+        nlookups = nhits = nstores = nevictions = 0;
+    }
+    void set_max_bytes(size_t n) {
+        max_entries = n/NOGOOD_BYTES;
+    }
+    bool lookup(uint64_t h) {
+        nlookups++;
+        if (set.find(h) == set.end()) return false;
+        nhits++;
+        return true;
+    }
+    void insert(uint64_t h) {
+        if (!max_entries) return;
+        if (!set.insert(h).second) return;
+        nstores++;
+        fifo.push_back(h);
+        if (fifo.size() > max_entries) {
+            set.erase(fifo.front());
+            fifo.pop_front();
+            nevictions++;
+        }
+    }
+    void print_stats(FILE *f) {
+        fprintf(f, "nogoods: %lu stored, %ld lookups, %ld hits, %ld evictions\n",
+            set.size(), nlookups, nhits, nevictions
+        );
+    }
+    static const size_t NOGOOD_BYTES = 48;
+        // approximate memory per entry (hash set node, bucket, and FIFO)
+};
+
+// a change to a slot's compatible list (and maybe pattern)
+// that must be undone on backtrack.
+// The old list stays pinned while it's on the trail
+//
+struct TRAIL_ENTRY {
+    SLOT *slot;
+    int pos;
+        // if >= 0, a position in slot's pattern that was '_'
+    ILIST *list;
+};
+
+// --components: when the unfilled slots split into groups
+// that don't cross at unfilled cells
+// (e.g. the quadrants of a grid with a filled central spanner),
+// each group (component) is solved in turn, with the filled stack floor
+// at its first level, so a failure in one doesn't re-enumerate the others.
+// Words couple the components (a word can be used only once),
+// so if a component fails after rejecting a word used by an earlier one,
+// we backtrack into the earlier one as usual.
+//
+struct COMPONENT_FRAME {
+    size_t level;
+        // the size of the filled stack when the split was found
+    size_t outer_floor;
+        // floor_level to restore when the frame is popped
+    vector<vector<SLOT*> > comps;
+    unsigned int cur;
+        // the component being solved
+    size_t start;
+        // the size of the filled stack when it was started
+    uint64_t key;
+        // its state hash (see GRID::component_hash())
+    bool coupled;
+        // it rejected a word used by an earlier component
+    bool dup_outside;
+        // it rejected a word used by a slot outside it,
+        // or failed a --matching check;
+        // its result depends on more than its state, so isn't memoized
+    bool memo_hit;
+        // its result was found in the memo
+    COUNT base, product;
+        // with --count: the count before the split,
+        // and the product of the components' counts so far
+
+    COMPONENT_FRAME() {
+        level = 0;
+        outer_floor = 0;
+        cur = 0;
+        start = 0;
+        key = 0;
+        coupled = false;
+        dup_outside = false;
+        memo_hit = false;
+        base = product = 0;
+    }
+};
+
+// a word pushed while solving a component, for replaying its solution
+//
+struct COMPONENT_STEP {
+    SLOT *slot;
+    int word_index;
+    int next_word_index;
+};
+
+// the memoized result of solving a component in a given state:
+// with --count, its number of fills; otherwise
+// whether it has a fill, and the words of the first one
+//
+struct COMPONENT_MEMO {
+    bool solved;
+    vector<COMPONENT_STEP> steps;
+    COUNT count;
+};
+
+#define MAX_COMPONENT_MEMO 1000000
+    // the memo is cleared when it has this many entries
+
 struct GRID {
     vector<SLOT*> slots;
     vector<SLOT*> filled_slots;
@@ -118,13 +418,102 @@ struct GRID {
         // these are marked as filled but not pushed on the filled stack
     int nsteps;
         // total number of words installed (for performance testing)
+    int nrestarts;
+        // automatic restarts (--restarts) so far
+    long nsolutions;
+        // solutions found so far
+    COUNT solution_count;
+    long ncount_nodes;
+    bool count_overflow;
+        // with --count: solutions counted so far, the number of states
+        // where they were counted, and whether the count overflowed
+    size_t floor_level;
+        // backtrack() doesn't pop below this level of the filled stack.
+        // Nonzero when searching the subtree under a fixed prefix
+
+    // algorithm options.
+    // These are per grid so that concurrent searches can use different variants
+    bool do_prune;
+    bool do_backjump;
+    bool allow_dups;
+    bool do_propagate;
+    bool do_cbj;
+    bool do_nogoods;
+    bool do_lcv;
+    bool maximize_score;
+    bool use_mwords;
+    bool do_matching;
+    bool count_solutions;
+        // count solutions rather than stopping at them (see count_completions())
+    int score;
+        // total score of the words of filled (non-preset) slots
+    int best_score;
+    bool have_best;
+        // if maximize_score: the score of the best solution so far
+
+    SEARCH_CACHE cache;
+        // this search's word order and pattern lists;
+        // the word lists and letter index are shared
+    SLOT_HEAP slot_heap;
+        // the unfilled slots
+    vector<TRAIL_ENTRY> trail;
+        // pattern and list changes, most recent last
+    vector<SLOT*> prop_queue;
+        // slots whose lists changed, to propagate to their crossings
+    NOGOOD_STORE nogoods;
+        // not cleared by restart()
+    vector<int> word_level[MAX_LEN+1];
+        // word_level[len][i]: the lowest stack level of a filled slot
+        // whose word has canonical index i, or -1.
+        // Used to reject duplicate words in constant time
+    bool do_components;
+    vector<COMPONENT_FRAME> comp_frames;
+        // with --components: the splits we're in, innermost last
+    unordered_map<uint64_t, COMPONENT_MEMO> comp_memo;
+    long ncomp_splits, ncomp_memo_hits;
+    void (*grid_printer)(GRID&, bool curses, FILE*);
+        // how to draw the grid (print_grid() of the grid type), or NULL.
+        // With --verbose, the grid is drawn after each word
 
     GRID() {
         nsteps = 0;
+        nrestarts = 0;
+        nsolutions = 0;
+        solution_count = 0;
+        ncount_nodes = 0;
+        count_overflow = false;
+        floor_level = 0;
+        do_prune = false;
+        do_backjump = false;
+        allow_dups = false;
+        do_propagate = false;
+        do_cbj = false;
+        do_nogoods = false;
+        do_lcv = false;
+        maximize_score = false;
+        use_mwords = false;
+        do_matching = false;
+        count_solutions = false;
+        do_components = false;
+        ncomp_splits = 0;
+        ncomp_memo_hits = 0;
+        have_best = false;
+        best_score = 0;
+        score = 0;
+        grid_printer = NULL;
+    }
+    ~GRID() {
+        // slots are added with new (by make_grid() or clone())
+        for (SLOT *s: slots) delete s;
     }
     void add_slot(SLOT* slot) {
+        slot->grid = this;
+        slot->index = slots.size();
         slots.push_back(slot);
     }
+    inline PATTERN_CACHE& pattern_cache(int len) {
+        return cache.pattern_cache[len];
+    }
     void add_link(SLOT *slot1, int pos1, SLOT *slot2, int pos2) {
         char c1 = slot1->filled_pattern[pos1];
         char c2 = slot2->filled_pattern[pos2];
@@ -159,21 +548,96 @@ struct GRID {
     //
     void prepare_grid() {
         npreset_slots = 0;
+        score = 0;
+        for (SLOT *s: slots) {
+            word_level[s->len].assign(words.words[s->len].size(), -1);
+            s->conflicts.init(slots.size());
+        }
+        slot_heap.clear();
         for (SLOT *s: slots) {
             s->prepare_slot();
                 // this sets filled if needed
             if (s->filled) {
                 npreset_slots++;
+            } else {
+                slot_heap.insert(s);
             }
         }
+        if (do_propagate) {
+            // make the initial lists arc consistent.
+            // If a list becomes empty, the search fails at the first step
+            //
+            for (SLOT *s: slots) {
+                if (!s->filled) enqueue(s);
+            }
+            propagate();
+        }
     }
 
     bool push_next_slot();
+    SLOT* select_slot();
+    bool push_slot(SLOT*);
+    void pop_slot();
     bool backtrack();
-    void install_word(SLOT*);
-    bool find_solutions();
-    void restart();
+    bool backtrack_stack();
+    bool conflict_jump(SLOT*, int level);
+    bool install_word(SLOT*);
+    void set_list_trail(SLOT*, ILIST*, int pos=-1);
+    void undo_trail(size_t level);
+    void clear_trail();
+    inline void enqueue(SLOT *slot) {
+        if (slot->in_queue) return;
+        slot->in_queue = true;
+        prop_queue.push_back(slot);
+    }
+    bool propagate();
+    inline void use_word(SLOT *slot) {
+        int &level = word_level[slot->len][slot->word_index];
+        if (level < 0 && !slot->free_mask) level = slot->stack_level;
+        score += words.score[slot->len][slot->word_index];
+    }
+    inline void unuse_word(SLOT *slot) {
+        int &level = word_level[slot->len][slot->word_index];
+        if (level == slot->stack_level && !slot->free_mask) level = -1;
+        score -= words.score[slot->len][slot->word_index];
+    }
+    bool match_words(int len, SLOT *extra, bool assign);
+    bool check_matching(SLOT *slot);
+    bool expand_mwords();
+    int score_bound();
+    void unfilled_scope(vector<SLOT*>&);
+    SLOT* scope_top();
+    uint64_t component_hash(vector<SLOT*>&);
+    bool split_components();
+    void start_component(COMPONENT_FRAME&);
+    bool next_component();
+    bool replay_component(COMPONENT_MEMO&);
+    bool component_exhausted();
+    void note_dup(int level);
+    void clear_components();
+    bool count_completions(COUNT&);
+    void add_count(COUNT);
     int get_commands();
+        // the command-line program's solution prompt (xw_main.cpp)
+    void restart(unsigned int seed);
+    GRID* clone();
+    const char* variant_name();
 };
 
+// if the slot is in the heap, its position depends on the list size
+//
+inline void SLOT::set_compatible_words(ILIST *ilist) {
+    if (ilist) pin_list(ilist);
+    if (compatible_words) unpin_list(compatible_words);
+    compatible_words = ilist;
+    if (heap_pos >= 0) grid->slot_heap.update(this);
+}
+
+extern void print_grid(GRID&, bool curses, FILE *f);
+    // supplied by the grid-type-specific code
+
+// parallel.cpp
+extern bool find_first_solution_parallel(GRID&, int nthreads);
+extern bool find_first_solution_portfolio(GRID&, int n);
+
 #endif
@@ -0,0 +1,647 @@
+// xw: fill generalized crossword puzzle grids.
+// The command-line program: options, output, and the interactive loop.
+// copyright (C) 2025 David P. Anderson
+
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <sys/types.h>
+#include <unistd.h>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "solver.h"
+
+const char* options = "\
+options:\n\
+--allow_dups        allow duplicate words\n\
+--backjump          backtrack over multiple slots\n\
+--cbj               conflict-directed backjumping\n\
+--cache_mb x        limit pattern cache to x MB (default 1000; 0 = no limit)\n\
+--components        solve groups of unfilled slots that don't cross separately\n\
+--count             count solutions; don't enumerate the fills of slots\n\
+                    whose crossings are all filled\n\
+--curses            show partial solutions with curses\n\
+--enumerate         find all solutions without stopping;\n\
+                    write them to the solution file, one JSON line each\n\
+--grid_file f       use the given grid file in ../grids\n\
+--help              show options\n\
+--limit n           with --enumerate, stop after n solutions\n\
+--lcv               try words that leave crossing slots the most words first\n\
+--max_time x        give up after x CPU seconds\n\
+--matching          check that the unfilled slots can still get distinct words\n\
+--maximize_score    find the solution with the highest total word score\n\
+                    (word list lines are 'word;score'); show each better one\n\
+--mwords            in slots with unchecked cells, try only one of the words\n\
+                    that differ only there; pick the words at the end\n\
+--nogood_mb x       limit nogood store to x MB (default 100)\n\
+--nogoods           remember slot states with no usable words,\n\
+                    and don't descend into them (kept across restarts)\n\
+--pattern_snapshot f\n\
+                    keep pattern lists in f across runs: map it at start,\n\
+                    and add the lists computed in this run at exit\n\
+--perf              on 1st solution, print JSON info and exit\n\
+--propagate         after each word, make crossing word lists consistent\n\
+                    (arc consistency); fail as soon as a list is empty\n\
+--portfolio n       run n searches with different variants and seeds\n\
+                    concurrently; report the first to find a solution\n\
+--prune             prune compatible word lists\n\
+--restarts luby:b   until a solution is found, restart with a new word order\n\
+                    after b*1, b*1, b*2, b*1, b*1, b*2, b*4 ... steps\n\
+--reverse           allow words to be reversed\n\
+--show_grid         show grid details at start\n\
+--shuffle           shuffle words with nondeterministic seed\n\
+--solution_file f   write solutions to f (default 'solution')\n\
+--step_period n     show partial solution and check CPU time every n changes\n\
+--threads n         find the first solution using n threads\n\
+                    (--max_time is then per thread)\n\
+--verbose           show each slot and word addition\n\
+--verbose_slot      show slot selection details\n\
+--verbose_word      show word selection details\n\
+--verbose_prune     show pruning details\n\
+--verbose_propagate show propagation details\n\
+--veto_file f       use given veto file (default 'vetoed_words')\n\
+--word_list f       use given word list\n\
+                    (text, or compiled with xwdict)\n\
+";
+
+// This must be linked with two grid-type-specific functions:
+
+extern void make_grid(const char* &filename, GRID&);
+    // read the given file and populate the GRID structure.
+    // We supply two variants:
+    // black-square format (NYT type puzzles)
+    // line-grid format (Atlantic cryptic type puzzles)
+extern void print_grid(GRID&, bool curses, FILE *f);
+    // print the (partially-filled) grid
+    // if curses is true, use curses
+    // else write to the given FILE*
+
+// files
+const char* grid_file = NULL;
+const char* veto_fname = "vetoed_words";
+const char* solution_fname = "solutions";
+const char* word_list = "../words/words";
+const char* snapshot_fname = NULL;
+
+bool curses = false;
+int step_period = 10000;
+double max_time = 0;
+bool perf = false;
+int nthreads = 1;
+int nportfolio = 0;
+int restart_base = 0;
+    // if nonzero, restart after restart_base*luby(i) steps
+bool enumerate = false;
+long enum_limit = 0;
+    // with --enumerate: if nonzero, stop after this many solutions
+
+// behavior
+bool shuffle = false;
+bool reverse_words = false;
+
+FILE* solution_file;
+
+char* date_str() {
+    static char buf[256];
+    time_t t = time(0);
+    strcpy(buf, ctime(&t));
+    buf[strlen(buf)-1] = 0;
+    return buf;
+}
+
+void print_params(GRID &grid) {
+    printf("date: %s\n", date_str());
+    printf("grid file: %s\n", grid_file);
+    printf("word list: %s\n", word_list);
+    words.print_vetoed_words();
+    printf("backjump: %s\n", grid.do_backjump?"yes":"no");
+    printf("conflict-directed backjump: %s\n", grid.do_cbj?"yes":"no");
+    printf("prune: %s\n", grid.do_prune?"yes":"no");
+    printf("propagate: %s\n", grid.do_propagate?"yes":"no");
+    printf("nogoods: %s\n", grid.do_nogoods?"yes":"no");
+    printf("least-constraining value order: %s\n", grid.do_lcv?"yes":"no");
+    printf("maximize score: %s\n", grid.maximize_score?"yes":"no");
+    printf("mwords: %s\n", grid.use_mwords?"yes":"no");
+    printf("matching: %s\n", grid.do_matching?"yes":"no");
+    printf("components: %s\n", grid.do_components?"yes":"no");
+    printf("reverse: %s\n", reverse_words?"yes":"no");
+    printf("allow dups: %s\n", grid.allow_dups?"yes":"no");
+    printf("pattern cache limit: %lu bytes\n", grid.cache.budget.max_bytes);
+}
+
+void print_perf_json(GRID &grid, int nsteps, double et, CACHE_BUDGET &budget) {
+    printf("{\n\
+        \"success\": 1,\n\
+        \"variant\": \"%s\",\n\
+        \"nsteps\": %d,\n\
+        \"score\": %d,\n\
+        \"nrestarts\": %d,\n\
+        \"nsolutions\": %ld,\n\
+        \"cpu_time\": %f,\n\
+        \"cache_hits\": %ld,\n\
+        \"cache_misses\": %ld,\n\
+        \"cache_evictions\": %ld,\n\
+        \"cache_snapshot_hits\": %ld,\n\
+        \"cache_bytes\": %lu,\n\
+        \"nogood_lookups\": %ld,\n\
+        \"nogood_hits\": %ld,\n\
+        \"nogoods\": %lu,\n\
+        \"component_splits\": %ld,\n\
+        \"component_memo_hits\": %ld\n\
+}\n",
+        grid.variant_name(), nsteps,
+        grid.have_best?grid.best_score:grid.score, grid.nrestarts,
+        grid.nsolutions, et,
+        budget.nhits, budget.nmisses,
+        budget.nevictions, budget.nsnapshot, budget.nbytes,
+        grid.nogoods.nlookups, grid.nogoods.nhits, grid.nogoods.set.size(),
+        grid.ncomp_splits, grid.ncomp_memo_hits
+    );
+}
+
+void print_fail_json() {
+    printf("{\n\
+        'success': 0;\n\
+}\n"
+    );
+}
+
+void print_count(GRID &grid, double start_cpu_time, bool complete) {
+    printf("Solutions: %s%s%s\n",
+        grid.count_overflow?"more than ":"",
+        count_str(grid.count_overflow?~(COUNT)0:grid.solution_count),
+        complete?"":" so far (incomplete)"
+    );
+    printf("Count states: %ld\n", grid.ncount_nodes);
+    printf("CPU time: %f\n", get_cpu_time() - start_cpu_time);
+    printf("Steps: %d\n", grid.nsteps);
+    grid.cache.budget.print_stats(stdout);
+    if (grid.do_nogoods) {
+        grid.nogoods.print_stats(stdout);
+    }
+}
+
+// returns from get_commands()
+#define CONT    1
+#define RESTART 2
+#define EXIT    3
+
+int GRID::get_commands() {
+    int retval = CONT;
+    while (1) {
+        printf("enter command\n"
+            "s: append solution to file (default 'solutions')\n"
+            "<CR>: next solution\n"
+            "v word: add word to veto list\n> "
+            "r: restart with new random word order\n> "
+            "q: quit\n> "
+        );
+        char buf[256];
+        fgets(buf, sizeof(buf), stdin);
+        int len = strlen(buf);
+        if (len == 1) {
+            return retval;
+        }
+        buf[len-1] = 0;
+        if (!strcmp(buf, "r")) {
+            return RESTART;
+        } else if (!strcmp(buf, "q")) {
+            return EXIT;
+        } else if (!strcmp(buf, "s")) {
+            print_grid(*this, false, solution_file);
+            fflush(solution_file);
+        } else if (strstr(buf, "v ")==buf) {
+            FILE *f = fopen(veto_fname, "a");
+            fprintf(f, "%s\n", buf+2);
+            fclose(f);
+            words.read_veto_file(veto_fname);
+            words.read(word_list, reverse_words);
+            words.build_index();
+            retval = RESTART;
+        } else {
+            printf("bad command %s\n", buf);
+        }
+    }
+}
+
+// --enumerate: write solutions to the solution file as JSON lines.
+// The first line has the slot names; then for each solution
+// {"n": <number>, "steps": <steps>, "words": [...]},
+// with the words in the same order.
+// Lines are collected in a buffer; full buffers are written
+// by a separate thread, so the search doesn't wait for the disk.
+//
+struct SOLUTION_WRITER {
+    FILE *f;
+    string buf;
+        // lines not yet handed to the writer thread
+    deque<string> queue;
+        // full buffers, oldest first
+    bool done;
+    mutex mtx;
+    condition_variable cv;
+    thread *writer;
+        // not a member object: if we exit() during the search,
+        // its destructor would abort
+
+    static const size_t BUF_BYTES = 1<<16;
+    static const size_t MAX_QUEUE = 64;
+        // if the writer falls this far behind, the search waits
+
+    void start(FILE *_f, GRID &grid) {
+        f = _f;
+        done = false;
+        buf = "{\"slots\":[";
+        for (unsigned int i=0; i<grid.slots.size(); i++) {
+            if (i) buf += ',';
+            buf += '"';
+            buf += grid.slots[i]->name;
+            buf += '"';
+        }
+        buf += "]}\n";
+        writer = new thread(&SOLUTION_WRITER::run, this);
+    }
+    void add(GRID &grid) {
+        char tmp[64];
+        sprintf(tmp, "{\"n\":%ld,\"steps\":%d,\"words\":[",
+            grid.nsolutions, grid.nsteps
+        );
+        buf += tmp;
+        for (unsigned int i=0; i<grid.slots.size(); i++) {
+            if (i) buf += ',';
+            buf += '"';
+            buf += grid.slots[i]->current_word;
+            buf += '"';
+        }
+        buf += "]}\n";
+        if (buf.size() >= BUF_BYTES) {
+            hand_off();
+        }
+    }
+    void hand_off() {
+        unique_lock<mutex> lock(mtx);
+        cv.wait(lock, [this]{return queue.size() < MAX_QUEUE;});
+        queue.push_back(string());
+        queue.back().swap(buf);
+        cv.notify_all();
+    }
+    void run() {
+        unique_lock<mutex> lock(mtx);
+        while (1) {
+            cv.wait(lock, [this]{return done || !queue.empty();});
+            if (queue.empty()) break;
+            string s;
+            s.swap(queue.front());
+            queue.pop_front();
+            cv.notify_all();
+            lock.unlock();
+            fwrite(s.data(), 1, s.size(), f);
+            lock.lock();
+        }
+        fflush(f);
+    }
+    // write what's left, and wait for the writer to finish
+    //
+    void finish() {
+        hand_off();
+        {
+            lock_guard<mutex> lock(mtx);
+            done = true;
+        }
+        cv.notify_all();
+        writer->join();
+        delete writer;
+    }
+};
+
+SOLUTION_WRITER solution_writer;
+
+// end of --enumerate: finish writing, and show the rate
+//
+void end_enumeration(GRID &grid, double start_cpu_time, const char* why) {
+    solution_writer.finish();
+    if (perf) {
+        print_perf_json(grid, grid.nsteps, get_cpu_time(), grid.cache.budget);
+        return;
+    }
+    double et = get_cpu_time() - start_cpu_time;
+    printf("Solutions: %ld (%s)\n", grid.nsolutions, why);
+    printf("CPU time: %f\n", et);
+    printf("Solutions per second: %f\n", et>0?grid.nsolutions/et:0.);
+    printf("Steps: %d\n", grid.nsteps);
+    grid.cache.budget.print_stats(stdout);
+    if (grid.do_nogoods) {
+        grid.nogoods.print_stats(stdout);
+    }
+}
+
+// find solutions with the SOLVER, and show or write them
+// as the options say
+//
+void find_solutions(SOLVER &solver, GRID &grid) {
+    double start_cpu_time = get_cpu_time();
+    if (verbose) {
+        grid.print_state();
+    }
+    if (enumerate) {
+        solution_writer.start(solution_file, grid);
+        solver.on_solution = [](GRID &g) {
+            solution_writer.add(g);
+            return true;
+        };
+    } else if (grid.maximize_score) {
+        // the bound check in install_word() ensures that
+        // each solution is better than any so far.
+        // Keep going until there's nothing better
+        //
+        solver.on_solution = [&](GRID &g) {
+            if (curses) {
+                clear();
+                refresh();
+                endwin();
+            }
+            if (!perf) {
+                printf("\nBetter solution found (score %d):\n", g.score);
+                print_grid(g, false, stdout);
+                printf("CPU time: %f\n", get_cpu_time() - start_cpu_time);
+                printf("Steps: %d\n", g.nsteps);
+                fflush(stdout);
+            }
+            if (curses) {
+                initscr();
+            }
+            return true;
+        };
+    } else {
+        solver.on_solution = [&](GRID &g) {
+            if (curses) {
+                clear();
+                refresh();
+                endwin();
+            }
+            double now = get_cpu_time();
+            if (perf) {
+                print_perf_json(g, g.nsteps, now, g.cache.budget);
+                exit(0);
+            }
+            printf("\nSolution found:\n");
+            print_grid(g, false, stdout);
+            printf("CPU time: %f\n", now - start_cpu_time);
+            printf("Steps: %d\n", g.nsteps);
+            if (restart_base) {
+                printf("Restarts: %d (solution found in run %d)\n",
+                    g.nrestarts, g.nrestarts+1
+                );
+            }
+            g.cache.budget.print_stats(stdout);
+            if (g.do_nogoods) {
+                g.nogoods.print_stats(stdout);
+            }
+            if (verbose) {
+                exit(0);
+            }
+            switch (g.get_commands()) {
+            case RESTART:
+                solver.restart_requested = true;
+                start_cpu_time = now;
+                break;
+            case EXIT:
+                exit(0);
+            }
+            if (curses) {
+                initscr();
+            }
+            return true;
+        };
+    }
+    if (!verbose && !perf && !enumerate && !grid.count_solutions) {
+        solver.on_progress = [](GRID &g) {
+            print_grid(g, curses, stdout);
+            return true;
+        };
+    }
+
+    switch (solver.search(grid)) {
+    case SOLVE_STOPPED:
+        // the --limit was reached
+        end_enumeration(grid, start_cpu_time, "limit reached");
+        return;
+    case SOLVE_TIMEOUT:
+        if (enumerate) {
+            end_enumeration(grid, start_cpu_time, "max CPU time exceeded");
+        } else if (grid.count_solutions) {
+            printf("max CPU time exceeded\n");
+            print_count(grid, start_cpu_time, false);
+        } else if (perf && grid.have_best) {
+            print_perf_json(grid, grid.nsteps, get_cpu_time(), grid.cache.budget);
+        } else if (perf) {
+            print_fail_json();
+        } else {
+            printf("max CPU time exceeded\n");
+            if (grid.have_best) {
+                printf("best score so far: %d\n", grid.best_score);
+            }
+        }
+        return;
+    }
+    if (grid.count_solutions) {
+        print_count(grid, start_cpu_time, true);
+        return;
+    }
+    if (enumerate) {
+        end_enumeration(grid, start_cpu_time, "all solutions found");
+        return;
+    }
+    if (grid.have_best) {
+        if (perf) {
+            print_perf_json(grid, grid.nsteps, get_cpu_time(), grid.cache.budget);
+            exit(0);
+        }
+        printf("best score: %d (no better solution exists)\n", grid.best_score);
+    }
+    printf("no more solutions\n");
+}
+
+// with --pattern_snapshot, save the main grid's lists.
+// Called at exit (which is how most runs end) or at the end of main()
+//
+static GRID *snapshot_grid = NULL;
+
+static void save_snapshot() {
+    if (!snapshot_grid) return;
+    snapshot.write(snapshot_fname, snapshot_grid->cache);
+    snapshot_grid = NULL;
+}
+
+int main(int argc, char** argv) {
+    GRID grid;
+    SOLVER solver;
+    SOLVER_CONFIG &config = solver.config;
+    bool show_grid = false;
+    bool help = false;
+
+    for (int i=1; i<argc; i++) {
+        if (!strcmp(argv[i], "--allow_dups")) {
+            config.allow_dups = true;
+        } else if (!strcmp(argv[i], "--backjump")) {
+            config.backjump = true;
+        } else if (!strcmp(argv[i], "--cbj")) {
+            config.cbj = true;
+        } else if (!strcmp(argv[i], "--cache_mb")) {
+            config.cache_bytes = (size_t)(atof(argv[++i])*1e6);
+        } else if (!strcmp(argv[i], "--count")) {
+            config.count = true;
+        } else if (!strcmp(argv[i], "--curses")) {
+            curses = true;
+        } else if (!strcmp(argv[i], "--grid_file")) {
+            grid_file = argv[++i];
+        } else if (!strcmp(argv[i], "--help")) {
+            help = true;
+        } else if (!strcmp(argv[i], "--enumerate")) {
+            enumerate = true;
+        } else if (!strcmp(argv[i], "--limit")) {
+            enum_limit = atol(argv[++i]);
+        } else if (!strcmp(argv[i], "--lcv")) {
+            config.lcv = true;
+        } else if (!strcmp(argv[i], "--components")) {
+            config.components = true;
+        } else if (!strcmp(argv[i], "--matching")) {
+            config.matching = true;
+        } else if (!strcmp(argv[i], "--mwords")) {
+            config.mwords = true;
+        } else if (!strcmp(argv[i], "--maximize_score")) {
+            config.maximize_score = true;
+        } else if (!strcmp(argv[i], "--max_time")) {
+            max_time = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--nogood_mb")) {
+            config.nogood_bytes = (size_t)(atof(argv[++i])*1e6);
+        } else if (!strcmp(argv[i], "--nogoods")) {
+            config.nogoods = true;
+        } else if (!strcmp(argv[i], "--pattern_snapshot")) {
+            snapshot_fname = argv[++i];
+        } else if (!strcmp(argv[i], "--perf")) {
+            perf = true;
+        } else if (!strcmp(argv[i], "--portfolio")) {
+            nportfolio = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--propagate")) {
+            config.propagate = true;
+        } else if (!strcmp(argv[i], "--prune")) {
+            config.prune = true;
+        } else if (!strcmp(argv[i], "--restarts")) {
+            const char *p = argv[++i];
+            if (strstr(p, "luby:") != p || (restart_base = atoi(p+5)) <= 0) {
+                fprintf(stderr, "--restarts: expected luby:<base>\n");
+                exit(1);
+            }
+        } else if (!strcmp(argv[i], "--reverse")) {
+            reverse_words = true;
+        } else if (!strcmp(argv[i], "--show_grid")) {
+            show_grid = true;
+        } else if (!strcmp(argv[i], "--shuffle")) {
+            shuffle = true;
+        } else if (!strcmp(argv[i], "--solution_file")) {
+            solution_fname = argv[++i];
+        } else if (!strcmp(argv[i], "--step_period")) {
+            step_period = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--threads")) {
+            nthreads = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--verbose")) {
+            verbose = true;
+        } else if (!strcmp(argv[i], "--verbose_slot")) {
+            verbose_slot = true;
+        } else if (!strcmp(argv[i], "--verbose_word")) {
+            verbose_word = true;
+        } else if (!strcmp(argv[i], "--verbose_prune")) {
+            verbose_prune = true;
+        } else if (!strcmp(argv[i], "--verbose_propagate")) {
+            verbose_propagate = true;
+        } else if (!strcmp(argv[i], "--veto_file")) {
+            veto_fname = argv[++i];
+        } else if (!strcmp(argv[i], "--word_list")) {
+            word_list = argv[++i];
+        } else {
+            fprintf(stderr, "unknown option '%s'\n", argv[i]);
+            exit(1);
+        }
+    }
+    if (help) {
+        printf("%s", options);
+        exit(0);
+    }
+    config.restart_base = restart_base;
+    config.max_time = max_time;
+    config.step_period = step_period;
+    config.max_solutions = enumerate?enum_limit:0;
+    if (shuffle) {
+        config.seed = time(0)+getpid();
+    }
+    const char *err = config.check();
+    if (err) {
+        fprintf(stderr, "%s\n", err);
+        exit(1);
+    }
+    if (config.maximize_score && (nthreads > 1 || nportfolio)) {
+        fprintf(stderr, "maximize_score can't be used with threads or portfolio\n");
+        exit(1);
+    }
+    if (config.components && (enumerate || nthreads > 1 || nportfolio)) {
+        fprintf(stderr, "components can't be used with enumerate, threads, or portfolio\n");
+        exit(1);
+    }
+    if (enumerate && (config.maximize_score || nthreads > 1 || nportfolio || curses)) {
+        fprintf(stderr, "enumerate can't be used with maximize_score, threads, portfolio, or curses\n");
+        exit(1);
+    }
+    if (config.count && (enumerate || nthreads > 1 || nportfolio || curses)) {
+        fprintf(stderr, "count can't be used with enumerate, threads, portfolio, or curses\n");
+        exit(1);
+    }
+    solution_file = fopen(solution_fname, "wa");
+    words.read_veto_file(veto_fname);
+    words.read(word_list, reverse_words);
+    if (grid_file) {
+        static char buf[256];
+            // grid_file points to this for the rest of the run
+        sprintf(buf, "../grids/%s", grid_file);
+        grid_file = buf;
+    }
+    make_grid(grid_file, grid);
+    grid.grid_printer = print_grid;
+    for (SLOT *s: grid.slots) {
+        // with a compiled word list, load only these lengths
+        words.need_length(s->len);
+    }
+    if (snapshot_fname) {
+        snapshot.read(snapshot_fname);
+        snapshot_grid = &grid;
+        atexit(save_snapshot);
+    }
+    words.build_index();
+    solver.configure(grid);
+    if (show_grid) {
+        grid.print_state(true);
+        exit(0);
+    }
+    if (verbose) {
+        print_params(grid);
+    }
+    if (nportfolio) {
+        find_first_solution_portfolio(grid, nportfolio);
+        exit(0);
+    }
+    if (nthreads > 1) {
+        find_first_solution_parallel(grid, nthreads);
+        exit(0);
+    }
+    if (curses) {
+        initscr();
+    }
+    find_solutions(solver, grid);
+    if (curses) {
+        endwin();
+    }
+    save_snapshot();
+}
@@ -0,0 +1,50 @@
+// xwdict: compile a word list for xw.
+//
+// xwdict [--reverse] [--veto_file f] infile outfile
+//
+// infile is a word list as read by xw (lines 'word' or 'word;score').
+// outfile is in the compiled format (see DICT_HEADER in words.h):
+// vetoes applied, duplicates removed, words packed.
+// xw maps it (--word_list outfile) and loads only the lengths it needs,
+// so startup is fast, and concurrent solvers share one copy.
+// Compile with --reverse to use it with xw --reverse.
+
+#include <cstdio>
+#include <cstring>
+
+#include "xw.h"
+
+bool verbose_prune = false;
+    // used by words.cpp
+
+int main(int argc, char** argv) {
+    bool reverse_words = false;
+    const char* veto_fname = NULL;
+    const char* fnames[2];
+    int nfnames = 0;
+    for (int i=1; i<argc; i++) {
+        if (!strcmp(argv[i], "--reverse")) {
+            reverse_words = true;
+        } else if (!strcmp(argv[i], "--veto_file")) {
+            veto_fname = argv[++i];
+        } else if (nfnames < 2) {
+            fnames[nfnames++] = argv[i];
+        } else {
+            nfnames = 0;
+            break;
+        }
+    }
+    if (nfnames != 2) {
+        fprintf(stderr, "usage: xwdict [--reverse] [--veto_file f] infile outfile\n");
+        exit(1);
+    }
+    if (veto_fname) {
+        words.read_veto_file(veto_fname);
+    }
+    words.read(fnames[0], reverse_words);
+    if (words.map_addr) {
+        fprintf(stderr, "%s is already compiled\n", fnames[0]);
+        exit(1);
+    }
+    words.write_dict(fnames[1], reverse_words);
+}
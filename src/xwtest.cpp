@@ -0,0 +1,191 @@
+// xwtest: check the search variants on small grids.
+// For each case, enumerate all solutions with SOLVER,
+// check each one against its crossings and the word list,
+// and compare the number of solutions with the expected number.
+// With count, solutions are counted rather than enumerated.
+// All variants of a grid must find the same solutions.
+//
+// usage (in src/): make test
+// Grids are in ../grids (bar format); the word list is ../words/test_words.
+// copyright (C) 2025 David P. Anderson
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unordered_set>
+
+#include "solver.h"
+
+extern void make_grid(const char* &filename, GRID&);
+
+#define WORD_LIST "../words/test_words"
+
+struct TEST_CASE {
+    const char *grid;
+        // grid file in ../grids
+    const char *options;
+        // SOLVER_CONFIG flags, separated by spaces
+    long nsolutions;
+        // with mwords: the number of fills of the checked cells
+};
+
+TEST_CASE tests[] = {
+    {"test_bar2", "", 868697},
+    {"test_bar2", "cbj", 868697},
+    {"test_bar2", "nogoods", 868697},
+    {"test_bar2", "propagate", 868697},
+    {"test_bar2", "matching", 868697},
+    {"test_bar2", "matching propagate", 868697},
+    {"test_bar2", "count", 868697},
+    {"test_bar2", "count cbj", 868697},
+    {"test_bar2", "count propagate", 868697},
+    {"test_bar2", "count components", 868697},
+    {"test_bar2", "components", 868697},
+    {"test_bar2", "components cbj", 868697},
+    {"test_bar2", "components propagate", 868697},
+    {"test_bar2", "mwords", 7018},
+    {"test_bar2", "mwords matching", 7018},
+    {"test_bar2", "mwords cbj", 7018},
+    {"test_bar2", "mwords lcv", 7018},
+    {"test_bar2", "mwords nogoods", 7018},
+    {"test_bar1", "", 1451901},
+    {"test_bar1", "count", 1451901},
+    {"test_bar1", "count cbj", 1451901},
+    {"test_bar1", "components", 1451901},
+    {"test_bar1", "components cbj", 1451901},
+    {"test_bar1", "components propagate", 1451901},
+    {"test_bar1", "mwords", 43225},
+    {"test_bar1", "mwords cbj", 43225},
+    {"test_bar1", "mwords nogoods", 43225},
+    {"test_bar1", "mwords propagate", 43225},
+
+    // a full 4x4 grid: 1038 fills, but only 14 without repeated words
+    {"test_square4", "", 14},
+    {"test_square4", "cbj", 14},
+    {"test_square4", "propagate", 14},
+    {"test_square4", "propagate cbj", 14},
+    {"test_square4", "nogoods", 14},
+    {"test_square4", "matching", 14},
+    {"test_square4", "count", 14},
+    {"test_square4", "count propagate", 14},
+};
+
+unordered_set<string> dict;
+    // the words of the list, to check solutions
+
+// set the config flag with the given name
+//
+bool set_option(SOLVER_CONFIG &c, const char *name) {
+    if (!strcmp(name, "allow_dups")) c.allow_dups = true;
+    else if (!strcmp(name, "prune")) c.prune = true;
+    else if (!strcmp(name, "backjump")) c.backjump = true;
+    else if (!strcmp(name, "cbj")) c.cbj = true;
+    else if (!strcmp(name, "propagate")) c.propagate = true;
+    else if (!strcmp(name, "nogoods")) c.nogoods = true;
+    else if (!strcmp(name, "lcv")) c.lcv = true;
+    else if (!strcmp(name, "mwords")) c.mwords = true;
+    else if (!strcmp(name, "matching")) c.matching = true;
+    else if (!strcmp(name, "components")) c.components = true;
+    else if (!strcmp(name, "count")) c.count = true;
+    else return false;
+    return true;
+}
+
+// a solution must have words from the list, agree at crossings,
+// and (unless allow_dups) have no word twice.
+// Return NULL if it does, else what's wrong
+//
+const char* check_solution(GRID &grid, bool allow_dups) {
+    unordered_set<string> used;
+    for (SLOT *s: grid.slots) {
+        if ((int)strlen(s->current_word) != s->len) return "wrong length";
+        if (!dict.count(s->current_word)) return "word not in list";
+        for (int i=0; i<s->len; i++) {
+            if (s->preset_pattern[i] != '_'
+                && s->preset_pattern[i] != s->current_word[i]
+            ) {
+                return "preset letter changed";
+            }
+            LINK &link = s->links[i];
+            if (link.empty()) continue;
+            if (s->current_word[i] != link.other_slot->current_word[link.other_pos]) {
+                return "crossing words disagree";
+            }
+        }
+        if (!allow_dups && !used.insert(s->current_word).second) {
+            return "duplicate word";
+        }
+    }
+    return NULL;
+}
+
+bool run_test(TEST_CASE &t) {
+    SOLVER solver;
+    solver.config.max_solutions = 0;
+    char buf[256];
+    strcpy(buf, t.options);
+    for (char *p = strtok(buf, " "); p; p = strtok(NULL, " ")) {
+        if (!set_option(solver.config, p)) {
+            printf("FAIL %s [%s]: unknown option %s\n", t.grid, t.options, p);
+            return false;
+        }
+    }
+    long nbad = 0;
+    const char *first_err = NULL;
+    solver.on_solution = [&](GRID &g) {
+        const char *err = check_solution(g, solver.config.allow_dups);
+        if (err) {
+            if (!nbad) first_err = err;
+            nbad++;
+        }
+        return true;
+    };
+    char path[256];
+    sprintf(path, "../grids/%s", t.grid);
+    const char *p = path;
+    GRID grid;
+    make_grid(p, grid);
+    int retval = solver.solve(grid);
+    long n = solver.config.count?(long)grid.solution_count:grid.nsolutions;
+    bool ok = true;
+    if (retval != SOLVE_DONE) {
+        printf("FAIL %s [%s]: solve() returned %d\n", t.grid, t.options, retval);
+        ok = false;
+    }
+    if (nbad) {
+        printf("FAIL %s [%s]: %ld bad solutions (%s)\n",
+            t.grid, t.options, nbad, first_err
+        );
+        ok = false;
+    }
+    if (n != t.nsolutions) {
+        printf("FAIL %s [%s]: %ld solutions, expected %ld\n",
+            t.grid, t.options, n, t.nsolutions
+        );
+        ok = false;
+    }
+    if (ok) {
+        printf("ok   %s [%s]: %ld solutions\n", t.grid, t.options, n);
+    }
+    return ok;
+}
+
+int main(int, char**) {
+    words.read(WORD_LIST, false);
+    words.build_index();
+    for (int len=1; len<=MAX_LEN; len++) {
+        for (char *w: words.words[len]) {
+            dict.insert(w);
+        }
+    }
+    int nfail = 0;
+    for (TEST_CASE &t: tests) {
+        if (!run_test(t)) nfail++;
+    }
+    if (nfail) {
+        printf("%d of %lu tests failed\n", nfail, sizeof(tests)/sizeof(tests[0]));
+        return 1;
+    }
+    printf("all tests passed\n");
+    return 0;
+}
@@ -7,7 +7,8 @@
 // infile has e.g.
 // WORD;50
 //
-// output words above a certain score, in lowercase.
+// output words above a certain score, in lowercase, with their scores
+// (e.g. word;50; xw uses these with --maximize_score).
 // skip words that aren't entirely alphabetic
 
 define('MIN_SCORE', 50);
@@ -21,7 +22,7 @@ function main($infile, $outfile) {
         if ((int)$x[1] < MIN_SCORE) continue;
         $w = $x[0];
         if (!ctype_alpha($w)) continue;
-        $out .= strtolower($w)."\n";
+        $out .= strtolower($w).";".(int)$x[1]."\n";
     }
     file_put_contents($outfile, $out);
 }